@@ -0,0 +1,132 @@
+/*
+// File: acalog.h
+//
+// Tracing of simulator events by level and category. Messages are written
+// with the LOG_* macros, e.g.
+//
+//   LOG_DEBUG(LOG_CACHE, "C" << id << " read hit, tag " << tag);
+//
+// which take an ostream expression without a trailing newline.
+//
+// The compile-time level ACALOG_LEVEL (default: LOG_LEVEL_INFO) removes all
+// messages above it: their macros expand to a branch that is never taken, so
+// the arguments are still type checked but no code is generated for them and
+// they are never evaluated. Build with -DACALOG_LEVEL=LOG_LEVEL_TRACE (or make
+// LOG_LEVEL=5) to compile in the per-access messages. Messages that are
+// compiled in cost one table lookup when disabled at run-time.
+//
+// Enabled messages are formatted by the caller and appended to a buffer,
+// which a separate thread writes to the log file. Call log_close() before
+// printing other output to the same file, so that the log comes first.
+//
+// The following options are used (see init_options in aca2009.h):
+//   --log-level=<level>        Run-time level of all categories: none, error,
+//                              warn, info, debug or trace (default: info)
+//   --log=<cat>[:<level>],...  Only log these categories (cpu, cache, bus,
+//                              coherence), optionally at another level
+//   --log-file=<file>          Write the log to this file (default: stdout)
+*/
+
+#ifndef ACALOG_H
+#define ACALOG_H
+
+#include <sstream>
+
+// Levels, a message is logged when its level is at most the configured level
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DEBUG     4
+#define LOG_LEVEL_TRACE     5
+
+#ifndef ACALOG_LEVEL
+#define ACALOG_LEVEL        LOG_LEVEL_INFO
+#endif
+
+enum log_category
+{
+    LOG_CPU,
+    LOG_CACHE,
+    LOG_BUS,
+    LOG_COHERENCE,
+    LOG_CATEGORY_COUNT
+};
+
+// Bit of a category in the default mask of log_init()
+#define LOG_MASK(category)  (1u << (category))
+#define LOG_MASK_ALL        ((1u << LOG_CATEGORY_COUNT) - 1)
+
+/*
+ * Reads the log options and starts the log thread, needs to be run after
+ * init_options. Categories that are not in default_mask are disabled unless
+ * the --log option names them.
+ */
+void log_init(unsigned int default_mask = LOG_MASK_ALL);
+
+// Writes all buffered messages and stops the log thread
+void log_close();
+
+// Appends a formatted message to the log
+void log_write(int level, log_category category, const std::string& message);
+
+// Run-time level per category, see log_enabled()
+extern unsigned char log_levels[LOG_CATEGORY_COUNT];
+
+inline bool log_enabled(int level, log_category category)
+{
+    return level <= log_levels[category];
+}
+
+#define ACALOG_WRITE(level, category, message)                      \
+    do                                                              \
+    {                                                               \
+        if (log_enabled(level, category))                           \
+        {                                                           \
+            std::ostringstream acalog_stream_;                      \
+            acalog_stream_ << message;                              \
+            log_write(level, category, acalog_stream_.str());       \
+        }                                                           \
+    } while (0)
+
+#define ACALOG_NOTHING(message)                                     \
+    do                                                              \
+    {                                                               \
+        if (false)                                                  \
+        {                                                           \
+            std::ostringstream acalog_stream_;                      \
+            acalog_stream_ << message;                              \
+        }                                                           \
+    } while (0)
+
+#if ACALOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(category, message)  ACALOG_WRITE(LOG_LEVEL_ERROR, category, message)
+#else
+#define LOG_ERROR(category, message)  ACALOG_NOTHING(message)
+#endif
+
+#if ACALOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(category, message)   ACALOG_WRITE(LOG_LEVEL_WARN, category, message)
+#else
+#define LOG_WARN(category, message)   ACALOG_NOTHING(message)
+#endif
+
+#if ACALOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(category, message)   ACALOG_WRITE(LOG_LEVEL_INFO, category, message)
+#else
+#define LOG_INFO(category, message)   ACALOG_NOTHING(message)
+#endif
+
+#if ACALOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category, message)  ACALOG_WRITE(LOG_LEVEL_DEBUG, category, message)
+#else
+#define LOG_DEBUG(category, message)  ACALOG_NOTHING(message)
+#endif
+
+#if ACALOG_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(category, message)  ACALOG_WRITE(LOG_LEVEL_TRACE, category, message)
+#else
+#define LOG_TRACE(category, message)  ACALOG_NOTHING(message)
+#endif
+
+#endif
@@ -0,0 +1,62 @@
+/*
+// File: backing_store.h
+//
+// Contents of the simulated main memory. The 4 GB address space is kept as
+// a two-level radix tree of 4 kB pages: the top 10 bits of an address
+// select a table, the next 10 bits a page in it. Tables and pages are only
+// allocated when they are first written, pages from an arena of large
+// chunks, so a trace that touches a few MB costs a few MB. Memory that was
+// never written reads as zero.
+//
+// The caches fill whole lines from the backing store and write whole lines
+// back to it, so that the simulated values stay consistent and can be
+// checked. Addresses of lines must be aligned to the line size, and a line
+// may not cross a page.
+*/
+
+#ifndef BACKING_STORE_H
+#define BACKING_STORE_H
+
+#include <stdint.h>
+#include <vector>
+
+class BackingStore
+{
+public:
+    static const unsigned int PAGE_BITS  = 12;
+    static const unsigned int PAGE_SIZE  = 1 << PAGE_BITS;
+    static const unsigned int TABLE_BITS = 10;
+    static const unsigned int TABLE_SIZE = 1 << TABLE_BITS;
+
+    BackingStore();
+    ~BackingStore();
+
+    // Copies words 32 bit words from/to the line at addr
+    void read_line(uint32_t addr, uint32_t* data, unsigned int words) const;
+    void write_line(uint32_t addr, const uint32_t* data, unsigned int words);
+
+    // Single words, addr is rounded down to a multiple of 4
+    uint32_t read_word(uint32_t addr) const;
+    void     write_word(uint32_t addr, uint32_t value);
+
+    // Number of pages allocated so far
+    uint64_t pages() const { return m_pages; }
+
+private:
+    // Page holding addr, or NULL when it was never written
+    const uint32_t* find_page(uint32_t addr) const;
+
+    // Page holding addr, allocated when needed
+    uint32_t* page(uint32_t addr);
+
+    // Not copyable
+    BackingStore(const BackingStore&);
+    BackingStore& operator=(const BackingStore&);
+
+    uint32_t**             m_tables[TABLE_SIZE];
+    std::vector<uint8_t*>  m_chunks;        // arena of pages
+    unsigned int           m_chunk_used;    // pages used in the last chunk
+    uint64_t               m_pages;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/*
+// File: cache_hierarchy.h
+//
+// Cache levels below the L1 caches of the simulators: a private L2 per CPU
+// and an L3 shared by all CPUs and split into banks, in front of memory.
+// The levels are built from the cache model (see cache_model.h) and only
+// hold tags: they decide how long an L1 miss takes, the L1 keeps the data.
+// The hierarchy does not depend on SystemC, the caller waits for the
+// latency that miss() returns.
+//
+// The inclusion of the L1 in the L2 and of the L2 in the L3 is one of:
+//   inclusive  A line filled in a level is filled in all levels below it,
+//              a line evicted from a level is removed from the levels above
+//              it (back-invalidation)
+//   exclusive  A line is in one level at a time: a hit below the L1 moves
+//              the line up to the L1, lines evicted from a level move to the
+//              level below it
+//   nine       Non-inclusive non-exclusive: fills as inclusive, but evictions
+//              do not remove lines from other levels
+//
+// All levels use the line size of the L1. The following options are used
+// (see init_options in aca2009.h):
+//   --l2-size=<bytes>          Size of each L2, 0 for none (default: 0)
+//   --l2-ways, --l2-policy     Associativity (default: 8) and replacement
+//                              policy (default: plru) of the L2
+//   --l2-latency=<cycles>      L2 lookup latency (default: 10)
+//   --l3-size=<bytes>          Total size of the L3, 0 for none (default: 0)
+//   --l3-banks=<n>             Number of L3 banks, the lines are interleaved
+//                              over the banks (default: 1)
+//   --l3-ways, --l3-policy     As for the L2 (default: 16, plru)
+//   --l3-latency=<cycles>      L3 lookup latency (default: 30)
+//   --mem-latency=<cycles>     Memory latency (default: 100)
+//   --inclusion=<policy>       inclusive, exclusive or nine (default: nine)
+//
+// Without L2 and L3 an L1 miss takes the memory latency, as in the original
+// simulators. The hits and misses of every level are registered as metrics
+// (see metrics.h): "cpu<N>.l2hit", "cpu<N>.l2miss", "l3.bank<B>.hit",
+// "l3.bank<B>.miss", "memory.reads" and "l1.backinval".
+*/
+
+#ifndef CACHE_HIERARCHY_H
+#define CACHE_HIERARCHY_H
+
+#include <stdint.h>
+#include <vector>
+#include "cache_model.h"
+
+enum inclusion_policy
+{
+    INCLUSION_INCLUSIVE,
+    INCLUSION_EXCLUSIVE,
+    INCLUSION_NINE
+};
+
+/*
+ * Removes the line holding addr from an L1 cache, called when an inclusive
+ * hierarchy evicts the line from a lower level. l1 is the pointer given to
+ * CacheHierarchy::attach(). Returns whether the L1 held the line.
+ */
+typedef bool (*hierarchy_invalidate)(void* l1, uint32_t addr);
+
+class CacheHierarchy
+{
+public:
+    // Creates the levels from the options, for cpus CPUs with L1 caches with
+    // lines of line_size bytes
+    CacheHierarchy(unsigned int cpus, unsigned int line_size);
+    ~CacheHierarchy();
+
+    // Sets the function that removes lines from the L1 of cpu
+    void attach(uint32_t cpu, hierarchy_invalidate invalidate, void* l1);
+
+    /*
+     * Fetches the line holding addr for the L1 of cpu, and returns the
+     * number of cycles it takes: the latencies of all levels that are
+     * looked up, and of memory when all of them miss.
+     */
+    unsigned int miss(uint32_t cpu, uint32_t addr);
+
+    // Tells the hierarchy that the L1 of cpu evicted the line holding addr
+    void evict(uint32_t cpu, uint32_t addr);
+
+    inclusion_policy inclusion() const { return m_inclusion; }
+    unsigned int memory_latency() const { return m_mem_latency; }
+
+    // Pretty-prints the hits and misses of each level
+    void print() const;
+
+private:
+    // Counters owned by the metrics registry
+    struct level_stats
+    {
+        uint64_t* hit;
+        uint64_t* miss;
+    };
+
+    // L3 bank of a line and the address of the line within the bank
+    uint32_t bank_of(uint32_t addr) const;
+    uint32_t bank_addr(uint32_t addr) const;
+    uint32_t line_addr(uint32_t bank, uint32_t set, uint32_t tag) const;
+
+    // Puts a line in a level, handling the line it replaces
+    void fill_l2(uint32_t cpu, uint32_t addr);
+    void fill_l3(uint32_t addr);
+
+    void invalidate_l1(uint32_t cpu, uint32_t addr);
+    void invalidate_l2(uint32_t cpu, uint32_t addr);
+
+    // Not copyable
+    CacheHierarchy(const CacheHierarchy&);
+    CacheHierarchy& operator=(const CacheHierarchy&);
+
+    unsigned int                      m_cpus;
+    unsigned int                      m_line_size;
+    inclusion_policy                  m_inclusion;
+    std::vector<CacheArray*>          m_l2;         // per CPU, empty without L2
+    std::vector<CacheArray*>          m_l3;         // per bank, empty without L3
+    unsigned int                      m_bank_bits;
+    unsigned int                      m_offset_bits;
+    unsigned int                      m_l2_latency;
+    unsigned int                      m_l3_latency;
+    unsigned int                      m_mem_latency;
+    std::vector<hierarchy_invalidate> m_invalidate;
+    std::vector<void*>                m_l1;
+    std::vector<level_stats>          m_l2_stats;
+    std::vector<level_stats>          m_l3_stats;
+    uint64_t*                         m_mem_reads;
+    uint64_t*                         m_backinval;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+// File: cache_model.cpp
+//
+// Run-time selection of a cache geometry and replacement policy, see
+// cache_model.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <sstream>
+#include <string.h>
+#include "cache_model.h"
+#include "aca2009.h"
+
+using namespace std;
+
+typedef CacheArray* (*cache_factory)(int invalid_state);
+
+// Replacement policies, in the order of cache_config::create
+static const char* const POLICY_NAMES[] =
+{
+    "lru", "plru", "srrip", "brrip", "random"
+};
+
+static const unsigned int POLICY_COUNT = sizeof POLICY_NAMES / sizeof POLICY_NAMES[0];
+
+struct cache_config
+{
+    unsigned int  size;
+    unsigned int  ways;
+    unsigned int  line_size;
+    cache_factory create[POLICY_COUNT];
+};
+
+// Makes a cache of a geometry, or NULL when the lines do not fill one set
+template <unsigned int Size, unsigned int Ways, unsigned int LineSize,
+          bool Valid = (Size >= Ways * LineSize)>
+struct cache_maker
+{
+    template <class Policy, unsigned int Index>
+    static CacheArray* create(int invalid_state)
+    {
+        return new CacheModel<Size, Ways, LineSize, Policy>(invalid_state, POLICY_NAMES[Index]);
+    }
+};
+
+template <unsigned int Size, unsigned int Ways, unsigned int LineSize>
+struct cache_maker<Size, Ways, LineSize, false>
+{
+    template <class Policy, unsigned int Index>
+    static CacheArray* create(int)
+    {
+        return NULL;
+    }
+};
+
+#define CACHE_CONFIG(size, ways, line)                                                  \
+    { size, ways, line,                                                                 \
+      { cache_maker<size, ways, line>::create<TrueLRU<ways>, 0>,                        \
+        cache_maker<size, ways, line>::create<TreePLRU<ways>, 1>,                       \
+        cache_maker<size, ways, line>::create<RRIP<ways, false>, 2>,                    \
+        cache_maker<size, ways, line>::create<RRIP<ways, true>, 3>,                     \
+        cache_maker<size, ways, line>::create<RandomPolicy<ways>, 4> } },
+
+// Each line size multiplies the instantiations, and the simulators use 32
+// byte lines, so the others are only built with CACHE_ALL_LINES set
+#ifndef CACHE_ALL_LINES
+#define CACHE_ALL_LINES 0
+#endif
+
+#if CACHE_ALL_LINES
+#define CACHE_LINES(size, ways)     \
+    CACHE_CONFIG(size, ways, 16)    \
+    CACHE_CONFIG(size, ways, 32)    \
+    CACHE_CONFIG(size, ways, 64)    \
+    CACHE_CONFIG(size, ways, 128)
+#else
+#define CACHE_LINES(size, ways)     \
+    CACHE_CONFIG(size, ways, 32)
+#endif
+
+#define CACHE_WAYS(size)            \
+    CACHE_LINES(size, 1)            \
+    CACHE_LINES(size, 2)            \
+    CACHE_LINES(size, 4)            \
+    CACHE_LINES(size, 8)            \
+    CACHE_LINES(size, 16)
+
+// All geometries that can be created, each one is a separate instantiation
+// per policy
+static const cache_config CACHE_CONFIGS[] =
+{
+    CACHE_WAYS(1 << 10)
+    CACHE_WAYS(1 << 11)
+    CACHE_WAYS(1 << 12)
+    CACHE_WAYS(1 << 13)
+    CACHE_WAYS(1 << 14)
+    CACHE_WAYS(1 << 15)
+    CACHE_WAYS(1 << 16)
+    CACHE_WAYS(1 << 17)
+    CACHE_WAYS(1 << 18)
+    CACHE_WAYS(1 << 19)
+    CACHE_WAYS(1 << 20)
+    CACHE_WAYS(1 << 21)
+    CACHE_WAYS(1 << 22)
+};
+
+CacheArray* cache_create(unsigned int size, unsigned int ways, unsigned int line_size,
+                         const char* policy, int invalid_state)
+{
+    unsigned int p = 0;
+    while (p < POLICY_COUNT && strcmp(POLICY_NAMES[p], policy) != 0)
+    {
+        p++;
+    }
+    if (p == POLICY_COUNT)
+    {
+        throw runtime_error(string("Error, unknown replacement policy: ") + policy);
+    }
+
+    for (size_t i = 0; i < sizeof CACHE_CONFIGS / sizeof CACHE_CONFIGS[0]; i++)
+    {
+        const cache_config& config = CACHE_CONFIGS[i];
+        if (config.size == size && config.ways == ways && config.line_size == line_size)
+        {
+            CacheArray* cache = config.create[p](invalid_state);
+            if (cache != NULL)
+            {
+                return cache;
+            }
+            break;
+        }
+    }
+
+    ostringstream msg;
+    msg << "Error, unsupported cache geometry: " << size << " bytes, "
+        << ways << " ways, " << line_size << " byte lines";
+    throw runtime_error(msg.str());
+}
+
+CacheArray* cache_create(const char* name, unsigned int size, unsigned int ways,
+                         unsigned int line_size, int invalid_state)
+{
+    string prefix(name);
+    size      = (unsigned int) option_int((prefix + "-size").c_str(), size);
+    ways      = (unsigned int) option_int((prefix + "-ways").c_str(), ways);
+    line_size = (unsigned int) option_int((prefix + "-line").c_str(), line_size);
+    const char* policy = option_string((prefix + "-policy").c_str(), "plru");
+    return cache_create(size, ways, line_size, policy, invalid_state);
+}
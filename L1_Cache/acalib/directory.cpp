@@ -0,0 +1,285 @@
+/*
+// File: directory.cpp
+//
+// Directory for directory-based coherence between the L1 caches, see
+// directory.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <stdio.h>
+#include "directory.h"
+#include "aca2009.h"
+
+using namespace std;
+
+static bool is_pow2(unsigned int value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+Directory::Directory(unsigned int cpus, unsigned int line_size, unsigned int entries)
+    : m_cpus(cpus), m_words((cpus + 63) / 64),
+      m_probe(cpus, (directory_probe) NULL), m_caches(cpus, (void*) NULL)
+{
+    entries       = (unsigned int) option_int("dir-entries", entries);
+    m_pointers    = (unsigned int) option_int("dir-pointers", 0);
+    m_dir_latency = (unsigned int) option_int("dir-latency", 10);
+    m_net_latency = (unsigned int) option_int("net-latency", 2);
+
+    m_ways        = (unsigned int) option_int("dir-ways", 8);
+    if (cpus == 0)
+    {
+        throw runtime_error("Error, a directory needs at least one cache");
+    }
+    if (!is_pow2(entries) || !is_pow2(m_ways) || m_ways > entries || !is_pow2(line_size))
+    {
+        throw runtime_error("Error, the directory entries and ways must be powers of two, "
+                            "with no more ways than entries");
+    }
+    m_sets        = entries / m_ways;
+    m_offset_bits = 0;
+    while ((1u << m_offset_bits) < line_size)
+    {
+        m_offset_bits++;
+    }
+    m_clock = 0;
+
+    unsigned int count = entries;
+    m_lines.assign(count, 0);
+    m_valid.assign(count, false);
+    m_used.assign(count, 0);
+    m_sharers.assign((size_t) count * m_words, 0);
+    m_count.assign(count, 0);
+    m_owner.assign(count, -1);
+    m_overflow.assign(count, false);
+
+    m_requests        = metrics_counter("dir.requests", "Misses and upgrades sent to the directory");
+    m_forwards        = metrics_counter("dir.forwards", "Reads forwarded to the owner");
+    m_invalidations   = metrics_counter("dir.invalidations", "Invalidation messages");
+    m_broadcasts      = metrics_counter("dir.broadcasts", "Invalidations sent to all caches");
+    m_recalls         = metrics_counter("dir.recalls", "Replaced entries whose line was invalidated");
+    m_written_sharers = metrics_histogram_create("dir.sharers", 1, 65,
+                                                 "Other sharers of a line that is written");
+}
+
+void Directory::attach(uint32_t cpu, directory_probe probe, void* cache)
+{
+    m_probe[cpu]  = probe;
+    m_caches[cpu] = cache;
+}
+
+bool Directory::is_sharer(unsigned int e, uint32_t cpu) const
+{
+    return (m_sharers[(size_t) e * m_words + cpu / 64] >> (cpu % 64)) & 1;
+}
+
+void Directory::add_sharer(unsigned int e, uint32_t cpu)
+{
+    if (is_sharer(e, cpu))
+    {
+        return;
+    }
+    if (m_pointers > 0 && m_count[e] == m_pointers)
+    {
+        // Out of pointers, the sharers are no longer known
+        m_overflow[e] = true;
+    }
+    m_sharers[(size_t) e * m_words + cpu / 64] |= (uint64_t) 1 << (cpu % 64);
+    m_count[e]++;
+}
+
+void Directory::clear_sharers(unsigned int e)
+{
+    for (unsigned int w = 0; w < m_words; w++)
+    {
+        m_sharers[(size_t) e * m_words + w] = 0;
+    }
+    m_count[e]    = 0;
+    m_owner[e]    = -1;
+    m_overflow[e] = false;
+}
+
+bool Directory::other_sharers(unsigned int e, uint32_t cpu) const
+{
+    return m_count[e] > (is_sharer(e, cpu) ? 1u : 0u);
+}
+
+bool Directory::probe_sharers(unsigned int e, uint32_t cpu, uint32_t addr, directory_probe_type type)
+{
+    // The bit vector is kept even when an entry overflows, but the
+    // hardware would not have it, so every cache gets the message then
+    bool broadcast = m_overflow[e];
+    bool supplied  = false;
+    if (broadcast)
+    {
+        (*m_broadcasts)++;
+    }
+    for (uint32_t i = 0; i < m_cpus; i++)
+    {
+        if (i == cpu || (!broadcast && !is_sharer(e, i)))
+        {
+            continue;
+        }
+        (*m_invalidations)++;
+        if (m_probe[i] != NULL && m_probe[i](m_caches[i], addr, type))
+        {
+            supplied = true;
+        }
+    }
+    return supplied;
+}
+
+int Directory::find(uint32_t addr) const
+{
+    uint32_t     line  = addr >> m_offset_bits;
+    unsigned int first = (line & (m_sets - 1)) * m_ways;
+    for (unsigned int e = first; e < first + m_ways; e++)
+    {
+        if (m_valid[e] && m_lines[e] == line)
+        {
+            return (int) e;
+        }
+    }
+    return -1;
+}
+
+unsigned int Directory::entry(uint32_t addr)
+{
+    int found = find(addr);
+    if (found >= 0)
+    {
+        m_used[found] = ++m_clock;
+        return (unsigned int) found;
+    }
+
+    // An invalid entry of the set, otherwise the least recently used one
+    uint32_t     line   = addr >> m_offset_bits;
+    unsigned int first  = (line & (m_sets - 1)) * m_ways;
+    unsigned int e      = first;
+    for (unsigned int i = first; i < first + m_ways && m_valid[e]; i++)
+    {
+        if (!m_valid[i] || m_used[i] < m_used[e])
+        {
+            e = i;
+        }
+    }
+    if (m_valid[e] && m_count[e] > 0)
+    {
+        // Recall the line of the replaced entry from all its sharers
+        (*m_recalls)++;
+        probe_sharers(e, m_cpus, m_lines[e] << m_offset_bits, DIRECTORY_FETCH_INVALIDATE);
+    }
+    clear_sharers(e);
+    m_lines[e] = line;
+    m_valid[e] = true;
+    m_used[e]  = ++m_clock;
+    return e;
+}
+
+directory_result Directory::read(uint32_t cpu, uint32_t addr)
+{
+    (*m_requests)++;
+    unsigned int     e = entry(addr);
+    directory_result r;
+    r.supplied = false;
+    r.shared   = other_sharers(e, cpu);
+    r.latency  = m_net_latency + m_dir_latency + m_net_latency;
+
+    int owner = m_owner[e];
+    if (owner >= 0 && (uint32_t) owner != cpu)
+    {
+        // The owner supplies the line and keeps it as OWNED
+        (*m_forwards)++;
+        r.supplied = m_probe[owner] != NULL && m_probe[owner](m_caches[owner], addr, DIRECTORY_FORWARD);
+        r.latency += m_net_latency;
+    }
+
+    add_sharer(e, cpu);
+    if (!r.shared)
+    {
+        // The only copy is EXCLUSIVE
+        m_owner[e] = (int) cpu;
+    }
+    return r;
+}
+
+directory_result Directory::read_exclusive(uint32_t cpu, uint32_t addr)
+{
+    (*m_requests)++;
+    unsigned int     e = entry(addr);
+    directory_result r;
+    r.supplied = false;
+    r.shared   = false;
+    r.latency  = m_net_latency + m_dir_latency + m_net_latency;
+
+    if (other_sharers(e, cpu) || m_overflow[e])
+    {
+        metrics_histogram_add(m_written_sharers, m_count[e] - (is_sharer(e, cpu) ? 1 : 0));
+        r.supplied = probe_sharers(e, cpu, addr, DIRECTORY_FETCH_INVALIDATE);
+        r.latency += 2 * m_net_latency;
+    }
+
+    clear_sharers(e);
+    add_sharer(e, cpu);
+    m_owner[e] = (int) cpu;
+    return r;
+}
+
+directory_result Directory::upgrade(uint32_t cpu, uint32_t addr)
+{
+    (*m_requests)++;
+    unsigned int     e = entry(addr);
+    directory_result r;
+    r.supplied = false;
+    r.shared   = false;
+    r.latency  = m_net_latency + m_dir_latency + m_net_latency;
+
+    if (other_sharers(e, cpu) || m_overflow[e])
+    {
+        metrics_histogram_add(m_written_sharers, m_count[e] - (is_sharer(e, cpu) ? 1 : 0));
+        probe_sharers(e, cpu, addr, DIRECTORY_INVALIDATE);
+        r.latency += 2 * m_net_latency;
+    }
+
+    clear_sharers(e);
+    add_sharer(e, cpu);
+    m_owner[e] = (int) cpu;
+    return r;
+}
+
+void Directory::evict(uint32_t cpu, uint32_t addr)
+{
+    int found = find(addr);
+    if (found < 0)
+    {
+        return;
+    }
+    unsigned int e = (unsigned int) found;
+    if (m_owner[e] == (int) cpu)
+    {
+        m_owner[e] = -1;
+    }
+    if (m_overflow[e] || !is_sharer(e, cpu))
+    {
+        // An overflowed entry does not know its sharers any more
+        return;
+    }
+    m_sharers[(size_t) e * m_words + cpu / 64] &= ~((uint64_t) 1 << (cpu % 64));
+    if (--m_count[e] == 0)
+    {
+        clear_sharers(e);
+        m_valid[e] = false;
+    }
+}
+
+void Directory::print() const
+{
+    printf("Directory: %u entries, %s, %llu requests, %llu forwards, %llu invalidations "
+           "(%llu broadcast), %llu recalls\n",
+           m_sets * m_ways,
+           m_pointers ? "limited pointers" : "full bit vector",
+           (unsigned long long) *m_requests, (unsigned long long) *m_forwards,
+           (unsigned long long) *m_invalidations, (unsigned long long) *m_broadcasts,
+           (unsigned long long) *m_recalls);
+}
@@ -0,0 +1,154 @@
+/*
+// File: metrics.h
+//
+// Registry of named counters and histograms. Every module of a simulator
+// registers its counters here, so that all results of a run can be written
+// in one machine-readable file (JSON or CSV) at the end of the simulation,
+// and optionally at regular intervals during the simulation.
+//
+// Names are hierarchical and separated by dots, e.g. "bus.waits" or
+// "cpu3.readhit". The registry is not thread-safe: register all metrics
+// before the simulation starts. Counters registered by pointer are read
+// atomically, so they can be updated from other threads.
+//
+// The following options are used (see init_options in aca2009.h):
+//   --metrics-json=<file>      Write all metrics as JSON at the end
+//   --metrics-csv=<file>       Write all metrics as CSV at the end
+//   --metrics-interval=<n>     Also write all metrics every n cycles ...
+//   --metrics-interval-file=<file>  ... as one JSON object per line to this
+//                              file (default: metrics_intervals.jsonl)
+//
+// Epoch sampling records how much every counter grew in each epoch of a
+// fixed number of cycles or accesses into a table that is allocated once,
+// when the first epoch starts. When the table is full, adjacent epochs are
+// merged and the epoch length doubles, so a run of any length fits.
+// Growth per epoch is stored in 32 bits and saturates. Samples are only
+// taken by metrics_tick() on the simulation thread; the stats_* functions
+// just count the accesses, from any host thread, so an epoch of accesses
+// ends at the first tick after its last access.
+//   --sample-cycles=<n>        Sample every n cycles, or
+//   --sample-accesses=<n>      every n memory accesses (stats_* calls)
+//   --sample-epochs=<n>        Size of the table, even (default: 65536)
+//   --sample-file=<file>       Write the table to this file at the end, in
+//                              binary if it ends with .bin, otherwise as CSV
+//                              (default: samples.csv)
+//
+// The binary file holds, in host byte order: "EPOC", the counter count
+// (32 bit), the epoch count (32 bit), 0 for cycles or 1 for accesses
+// (32 bit), the epoch length (64 bit) and the end of the last epoch
+// (64 bit), then per counter its name length (16 bit) and name, and finally
+// the epochs as rows of 32 bit counter increments.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include "aca2009.h"
+
+// A histogram with buckets of a fixed width, see metrics_histogram()
+struct metrics_histogram;
+
+/*
+ * Registers a counter owned by the registry and returns a pointer to it,
+ * which the caller increments directly. Registering a name twice returns
+ * the same counter.
+ */
+uint64_t* metrics_counter(const char* name, const char* description = "");
+
+/*
+ * Registers a counter owned by the caller. The value is read from the given
+ * location whenever the metrics are written.
+ */
+void metrics_register(const char* name, const uint64_t* value,
+                      const char* description = "");
+
+/*
+ * Registers a histogram of bucket_count buckets of bucket_width each. Values
+ * beyond the last bucket are counted in the last bucket, but are taken into
+ * account for the maximum. Registering a name twice returns the same
+ * histogram.
+ */
+metrics_histogram* metrics_histogram_create(const char* name, uint64_t bucket_width,
+                                            unsigned int bucket_count,
+                                            const char* description = "");
+
+// Adds a value to a histogram
+void metrics_histogram_add(metrics_histogram* h, uint64_t value);
+
+// Number of values, and value below which the given fraction of values lie
+uint64_t metrics_histogram_count(const metrics_histogram* h);
+uint64_t metrics_histogram_percentile(const metrics_histogram* h, double fraction);
+
+// Writes all metrics to the given file
+void metrics_write_json(FILE* f);
+void metrics_write_csv(FILE* f);
+
+/*
+ * Writes the metrics to the files given by the --metrics-json and
+ * --metrics-csv options, and the epoch samples to --sample-file, if any.
+ * To be called at the end of a simulation.
+ */
+void metrics_export();
+
+/*
+ * Starts the counters owned by the registry (see metrics_counter()) and all
+ * histograms over from zero, e.g. at the end of a warm-up. Counters
+ * registered by pointer belong to the caller and are left alone.
+ */
+void metrics_reset();
+
+// Removes all metrics and closes the interval file
+void metrics_cleanup();
+
+// Cycle at which the metrics are written next, see metrics_tick()
+extern uint64_t metrics_next_interval;
+
+// Cycle and access count at which the next epoch sample is taken
+extern uint64_t metrics_next_sample_cycle;
+extern uint64_t metrics_next_sample_access;
+
+// Number of memory accesses so far, see metrics_access()
+extern uint64_t metrics_accesses;
+
+// Latest cycle given to metrics_tick()
+extern uint64_t metrics_now;
+
+// Writes the metrics to the interval file, called by metrics_tick()
+void metrics_write_interval(uint64_t now);
+
+// Takes epoch samples up to now, called by metrics_tick()
+void metrics_sample(uint64_t now, bool accesses);
+
+/*
+ * Tells the registry the current simulated cycle. When --metrics-interval,
+ * --sample-cycles or --sample-accesses is given, the metrics are written or
+ * sampled every time another interval has passed. Costs three comparisons
+ * otherwise. To be called on the simulation thread only.
+ */
+inline void metrics_tick(uint64_t now)
+{
+    metrics_now = now;
+    if (now >= metrics_next_interval)
+    {
+        metrics_write_interval(now);
+    }
+    if (now >= metrics_next_sample_cycle)
+    {
+        metrics_sample(now, false);
+    }
+    uint64_t accesses = __atomic_load_n(&metrics_accesses, __ATOMIC_RELAXED);
+    if (accesses >= metrics_next_sample_access)
+    {
+        metrics_sample(accesses, true);
+    }
+}
+
+// Counts memory accesses for --sample-accesses, called by the stats_*
+// functions from any host thread. The samples are taken by metrics_tick()
+inline void metrics_access(uint64_t count = 1)
+{
+    __atomic_fetch_add(&metrics_accesses, count, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+// File: mshr.cpp
+//
+// Timing of the miss status holding registers, see mshr.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <stdio.h>
+#include "mshr.h"
+
+using namespace std;
+
+MSHRFile::MSHRFile(const char* name, unsigned int entries)
+    : m_lines(entries), m_done(entries), m_count(0)
+{
+    if (entries == 0)
+    {
+        throw runtime_error("Error, a cache needs at least one MSHR");
+    }
+
+    string prefix = string(name) + ".mshr.";
+    m_primary      = metrics_counter((prefix + "primary").c_str(), "Misses that fetch a line");
+    m_merged       = metrics_counter((prefix + "merged").c_str(), "Misses merged into an outstanding fetch");
+    m_stalls       = metrics_counter((prefix + "stalls").c_str(), "Misses that found all MSHRs in use");
+    m_stall_cycles = metrics_counter((prefix + "stall_cycles").c_str(), "Cycles stalled on the MSHRs");
+    m_occupancy    = metrics_histogram_create((prefix + "occupancy").c_str(), 1, entries + 1,
+                                              "MSHRs in use when a miss arrives");
+}
+
+void MSHRFile::retire(uint64_t now)
+{
+    // The MSHRs in use are kept in the first m_count slots
+    for (unsigned int i = 0; i < m_count; )
+    {
+        if (m_done[i] <= now)
+        {
+            m_count--;
+            m_lines[i] = m_lines[m_count];
+            m_done[i]  = m_done[m_count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+bool MSHRFile::merge(uint32_t addr, uint64_t now, uint64_t& done)
+{
+    retire(now);
+    for (unsigned int i = 0; i < m_count; i++)
+    {
+        if (m_lines[i] == addr)
+        {
+            (*m_merged)++;
+            done = m_done[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MSHRFile::full(uint64_t now)
+{
+    retire(now);
+    return m_count == m_lines.size();
+}
+
+unsigned int MSHRFile::allocate(uint32_t addr, uint64_t now, unsigned int latency, uint64_t& done)
+{
+    retire(now);
+    metrics_histogram_add(m_occupancy, m_count);
+    (*m_primary)++;
+
+    unsigned int stall = 0;
+    if (m_count == m_lines.size())
+    {
+        uint64_t oldest = m_done[0];
+        for (unsigned int i = 1; i < m_count; i++)
+        {
+            oldest = (m_done[i] < oldest) ? m_done[i] : oldest;
+        }
+        stall = (unsigned int) (oldest - now);
+        (*m_stalls)++;
+        *m_stall_cycles += stall;
+        retire(now + stall);
+    }
+
+    done = now + stall + latency;
+    m_lines[m_count] = addr;
+    m_done[m_count]  = done;
+    m_count++;
+    return stall;
+}
+
+void MSHRFile::print() const
+{
+    printf("MSHRs: %u, %llu primary and %llu merged misses, stalled %llu times (%llu cycles), "
+           "median occupancy %llu\n",
+           (unsigned int) m_lines.size(), (unsigned long long) *m_primary,
+           (unsigned long long) *m_merged, (unsigned long long) *m_stalls,
+           (unsigned long long) *m_stall_cycles,
+           (unsigned long long) metrics_histogram_percentile(m_occupancy, 0.5));
+}
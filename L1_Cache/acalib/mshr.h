@@ -0,0 +1,73 @@
+/*
+// File: mshr.h
+//
+// Timing of the miss status holding registers (MSHRs) of a non-blocking
+// cache. Every line that is being fetched from the levels below the cache
+// holds an MSHR until its fill completes. A miss to a line that already has
+// an MSHR (a secondary miss) is merged into it and completes with it,
+// without a fetch of its own. A primary miss stalls the cache when all MSHRs
+// are in use, until the oldest fill completes. Hits do not need an MSHR, so
+// they go on under outstanding misses.
+//
+// The MSHRs only keep the line addresses and the cycles at which their
+// fills complete. They do not depend on SystemC: the caller gives the
+// current cycle and waits for the stall that allocate() returns.
+//
+// The following metrics are registered (see metrics.h), with the name given
+// to the constructor as prefix: "<name>.mshr.primary", "<name>.mshr.merged",
+// "<name>.mshr.stalls", "<name>.mshr.stall_cycles" and the histogram
+// "<name>.mshr.occupancy" of the MSHRs in use when a miss arrives, i.e. the
+// memory-level parallelism.
+*/
+
+#ifndef MSHR_H
+#define MSHR_H
+
+#include <stdint.h>
+#include <vector>
+#include "metrics.h"
+
+class MSHRFile
+{
+public:
+    MSHRFile(const char* name, unsigned int entries);
+
+    /*
+     * Looks up the line at addr (aligned to the line size) at cycle now.
+     * When a fill of the line is outstanding, counts a merged miss, sets
+     * done to the cycle at which the fill completes and returns true.
+     */
+    bool merge(uint32_t addr, uint64_t now, uint64_t& done);
+
+    /*
+     * Allocates an MSHR for a fill of the line at addr that takes latency
+     * cycles, at cycle now. Returns the number of cycles the cache stalls
+     * because all MSHRs are in use, done is set to the cycle at which the
+     * fill completes.
+     */
+    unsigned int allocate(uint32_t addr, uint64_t now, unsigned int latency, uint64_t& done);
+
+    // Whether all MSHRs are in use at cycle now
+    bool full(uint64_t now);
+
+    unsigned int entries() const { return (unsigned int) m_lines.size(); }
+
+    // Pretty-prints the misses, stalls and occupancy
+    void print() const;
+
+private:
+    // Frees the MSHRs whose fills complete by cycle now
+    void retire(uint64_t now);
+
+    std::vector<uint32_t> m_lines;      // line of each MSHR in use
+    std::vector<uint64_t> m_done;       // cycle at which its fill completes
+    unsigned int          m_count;      // MSHRs in use, the first m_count
+
+    uint64_t*             m_primary;
+    uint64_t*             m_merged;
+    uint64_t*             m_stalls;
+    uint64_t*             m_stall_cycles;
+    metrics_histogram*    m_occupancy;
+};
+
+#endif
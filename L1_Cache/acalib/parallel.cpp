@@ -0,0 +1,150 @@
+/*
+// File: parallel.cpp
+//
+// Host threads for the private work of the simulated cores, see parallel.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include "parallel.h"
+#include "aca2009.h"
+
+using namespace std;
+
+ParallelRunner::ParallelRunner(unsigned int threads, unsigned int quantum)
+    : m_quantum(quantum), m_batch(0), m_busy(0), m_stop(false),
+      m_work(NULL), m_cores(NULL), m_count(0), m_next(0)
+{
+    if (threads == 0 || quantum == 0)
+    {
+        throw runtime_error("Error, the parallel simulation needs at least one thread and a quantum of one cycle");
+    }
+
+    m_batches    = metrics_counter("parallel.batches", "Batches of run-aheads");
+    m_runs       = metrics_counter("parallel.cores", "Run-aheads of cores over all batches");
+    m_cycles     = metrics_counter("parallel.cycles", "Cycles the cores ran ahead");
+    m_batch_size = metrics_histogram_create("parallel.batch_size", 1, 65,
+                                            "Run-aheads per batch");
+
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_start, NULL);
+    pthread_cond_init(&m_done, NULL);
+
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, thread_main, this) != 0)
+        {
+            // Run with the threads that could be started
+            break;
+        }
+        m_threads.push_back(thread);
+    }
+}
+
+ParallelRunner::~ParallelRunner()
+{
+    pthread_mutex_lock(&m_lock);
+    m_stop = true;
+    pthread_cond_broadcast(&m_start);
+    pthread_mutex_unlock(&m_lock);
+
+    for (size_t i = 0; i < m_threads.size(); i++)
+    {
+        pthread_join(m_threads[i], NULL);
+    }
+    pthread_mutex_destroy(&m_lock);
+    pthread_cond_destroy(&m_start);
+    pthread_cond_destroy(&m_done);
+}
+
+void ParallelRunner::work()
+{
+    for (;;)
+    {
+        size_t i = __atomic_fetch_add(&m_next, 1, __ATOMIC_RELAXED);
+        if (i >= m_count)
+        {
+            break;
+        }
+        m_work(m_cores[i]);
+    }
+}
+
+void* ParallelRunner::thread_main(void* arg)
+{
+    ParallelRunner* runner = (ParallelRunner*) arg;
+    uint64_t        batch  = 0;
+
+    pthread_mutex_lock(&runner->m_lock);
+    for (;;)
+    {
+        while (runner->m_batch == batch && !runner->m_stop)
+        {
+            pthread_cond_wait(&runner->m_start, &runner->m_lock);
+        }
+        if (runner->m_stop)
+        {
+            break;
+        }
+        batch = runner->m_batch;
+        pthread_mutex_unlock(&runner->m_lock);
+
+        runner->work();
+
+        pthread_mutex_lock(&runner->m_lock);
+        if (--runner->m_busy == 0)
+        {
+            pthread_cond_signal(&runner->m_done);
+        }
+    }
+    pthread_mutex_unlock(&runner->m_lock);
+    return NULL;
+}
+
+void ParallelRunner::run(parallel_work work, void* const* cores, size_t count)
+{
+    (*m_batches)++;
+    (*m_runs) += count;
+    metrics_histogram_add(m_batch_size, count);
+
+    if (count == 1 || m_threads.empty())
+    {
+        // Waking the threads costs more than the work of one core
+        for (size_t i = 0; i < count; i++)
+        {
+            work(cores[i]);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_work  = work;
+    m_cores = cores;
+    m_count = count;
+    m_next  = 0;
+    m_busy  = (unsigned int) m_threads.size();
+    m_batch++;
+    pthread_cond_broadcast(&m_start);
+    pthread_mutex_unlock(&m_lock);
+
+    this->work();
+
+    // The batch is done when every thread has found it empty
+    pthread_mutex_lock(&m_lock);
+    while (m_busy > 0)
+    {
+        pthread_cond_wait(&m_done, &m_lock);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+ParallelRunner* parallel_create()
+{
+    unsigned int threads = (unsigned int) option_int("parallel-threads", 0);
+    if (threads == 0)
+    {
+        return NULL;
+    }
+    return new ParallelRunner(threads, (unsigned int) option_int("parallel-quantum", 100));
+}
@@ -0,0 +1,233 @@
+/*
+// File: prefetcher.cpp
+//
+// Hardware prefetchers, see prefetcher.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include "prefetcher.h"
+#include "metrics.h"
+#include "aca2009.h"
+
+using namespace std;
+
+static const unsigned int PAGE_BITS = 12;
+
+Prefetcher::Prefetcher(const char* name, unsigned int line_size)
+    : m_line_size(line_size)
+{
+    string prefix(name);
+    m_degree   = (unsigned int) option_int((prefix + "-prefetch-degree").c_str(), 1);
+    m_distance = (unsigned int) option_int((prefix + "-prefetch-distance").c_str(), 1);
+    m_issued   = metrics_counter((prefix + ".prefetch.issued").c_str(), "Lines prefetched");
+    m_useful   = metrics_counter((prefix + ".prefetch.useful").c_str(), "Prefetched lines hit by a demand access");
+    m_late     = metrics_counter((prefix + ".prefetch.late").c_str(), "Useful prefetches that had not arrived yet");
+}
+
+void Prefetcher::ahead(uint32_t addr, int32_t stride, vector<uint32_t>& lines) const
+{
+    for (unsigned int i = 0; i < m_degree; i++)
+    {
+        uint32_t target = addr + (uint32_t) (stride * (int32_t) (m_distance + i));
+        if ((target >> PAGE_BITS) != (addr >> PAGE_BITS))
+        {
+            break;
+        }
+        lines.push_back(target & ~(m_line_size - 1));
+    }
+}
+
+void Prefetcher::print(uint64_t misses) const
+{
+    uint64_t issued = *m_issued, useful = *m_useful;
+    printf("Prefetcher %s: %llu issued, %llu useful (accuracy %f), coverage %f, %llu late\n", type(),
+           (unsigned long long) issued, (unsigned long long) useful,
+           issued ? useful * 100.0 / issued : 0.0,
+           (useful + misses) ? useful * 100.0 / (useful + misses) : 0.0,
+           (unsigned long long) *m_late);
+}
+
+// Prefetches the lines following every line it is trained on
+class NextLinePrefetcher : public Prefetcher
+{
+public:
+    NextLinePrefetcher(const char* name, unsigned int line_size)
+        : Prefetcher(name, line_size)
+    {
+    }
+
+    void train(uint32_t addr, vector<uint32_t>& lines)
+    {
+        ahead(addr, (int32_t) m_line_size, lines);
+    }
+
+    const char* type() const { return "nextline"; }
+};
+
+// Reference prediction table indexed by page instead of program counter
+class StridePrefetcher : public Prefetcher
+{
+public:
+    StridePrefetcher(const char* name, unsigned int line_size)
+        : Prefetcher(name, line_size)
+    {
+        memset(m_table, 0, sizeof(m_table));
+    }
+
+    void train(uint32_t addr, vector<uint32_t>& lines)
+    {
+        uint32_t page  = addr >> PAGE_BITS;
+        entry&   e     = m_table[page % TABLE_SIZE];
+        if (!e.valid || e.page != page)
+        {
+            e.valid      = true;
+            e.page       = page;
+            e.last       = addr;
+            e.stride     = 0;
+            e.confidence = 0;
+            return;
+        }
+
+        int32_t stride = (int32_t) (addr - e.last);
+        if (stride == 0)
+        {
+            return;
+        }
+        if (stride == e.stride)
+        {
+            e.confidence = (e.confidence < 3) ? e.confidence + 1 : 3;
+        }
+        else if (e.confidence > 0)
+        {
+            e.confidence--;
+        }
+        else
+        {
+            e.stride = stride;
+        }
+        e.last = addr;
+
+        // A stride below a line would prefetch the same line
+        int32_t step = (e.stride < 0) ? -e.stride : e.stride;
+        if (e.confidence >= 1 && step >= (int32_t) m_line_size)
+        {
+            ahead(addr, e.stride, lines);
+        }
+    }
+
+    const char* type() const { return "stride"; }
+
+private:
+    static const unsigned int TABLE_SIZE = 64;
+
+    struct entry
+    {
+        bool     valid;
+        uint32_t page;
+        uint32_t last;          // last address trained on
+        int32_t  stride;
+        unsigned confidence;    // times the stride repeated, up to 3
+    };
+
+    entry m_table[TABLE_SIZE];
+};
+
+// Follows streams of accesses to nearby lines in one direction
+class StreamPrefetcher : public Prefetcher
+{
+public:
+    StreamPrefetcher(const char* name, unsigned int line_size)
+        : Prefetcher(name, line_size), m_clock(0)
+    {
+        memset(m_streams, 0, sizeof(m_streams));
+    }
+
+    void train(uint32_t addr, vector<uint32_t>& lines)
+    {
+        uint32_t line   = addr / m_line_size;
+        stream*  s      = NULL;
+        stream*  oldest = &m_streams[0];
+        for (unsigned int i = 0; i < STREAMS; i++)
+        {
+            stream& c = m_streams[i];
+            int32_t delta = (int32_t) (line - c.last);
+            if (c.used != 0 && delta != 0 && delta >= -WINDOW && delta <= WINDOW)
+            {
+                s = &c;
+                break;
+            }
+            oldest = (c.used < oldest->used) ? &c : oldest;
+        }
+
+        m_clock++;
+        if (s == NULL)
+        {
+            // A new stream, its direction is set by the next access
+            oldest->last       = line;
+            oldest->direction  = 0;
+            oldest->confidence = 0;
+            oldest->used       = m_clock;
+            return;
+        }
+
+        int direction = ((int32_t) (line - s->last) > 0) ? 1 : -1;
+        if (direction == s->direction)
+        {
+            s->confidence++;
+        }
+        else
+        {
+            s->direction  = direction;
+            s->confidence = 1;
+        }
+        s->last = line;
+        s->used = m_clock;
+
+        if (s->confidence >= 2)
+        {
+            ahead(addr, direction * (int32_t) m_line_size, lines);
+        }
+    }
+
+    const char* type() const { return "stream"; }
+
+private:
+    static const unsigned int STREAMS = 16;
+    static const int32_t      WINDOW  = 16;     // lines from the last access of a stream
+
+    struct stream
+    {
+        uint32_t last;          // last line of the stream
+        int      direction;     // 1 up, -1 down, 0 not known yet
+        unsigned confidence;    // accesses in the direction so far
+        uint64_t used;          // 0 for a free stream
+    };
+
+    stream   m_streams[STREAMS];
+    uint64_t m_clock;
+};
+
+Prefetcher* prefetcher_create(const char* name, unsigned int line_size)
+{
+    const char* type = option_string((string(name) + "-prefetch").c_str(), "none");
+    if (strcmp(type, "none") == 0)
+    {
+        return NULL;
+    }
+    if (strcmp(type, "nextline") == 0)
+    {
+        return new NextLinePrefetcher(name, line_size);
+    }
+    if (strcmp(type, "stride") == 0)
+    {
+        return new StridePrefetcher(name, line_size);
+    }
+    if (strcmp(type, "stream") == 0)
+    {
+        return new StreamPrefetcher(name, line_size);
+    }
+    throw runtime_error(string("Error, unknown prefetcher: ") + type);
+}
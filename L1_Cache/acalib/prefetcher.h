@@ -0,0 +1,86 @@
+/*
+// File: prefetcher.h
+//
+// Hardware prefetchers for the L1 caches. The cache trains its prefetcher on
+// every demand miss, and on the first demand hit to a line that a prefetch
+// brought in, so that a stream that is covered by prefetches keeps being
+// followed. The prefetcher answers with the lines to prefetch; the cache
+// drops the ones it already holds and fetches the others the way it fetches
+// a miss. Prefetches stay within the 4 kB page of the access that triggered
+// them, as the addresses in the traces are physical.
+//
+// Prefetchers (the --<name>-prefetch option):
+//   none      No prefetching (default)
+//   nextline  The lines following every miss
+//   stride    Reference prediction table without program counters: the
+//             strides between misses are tracked per 4 kB page, and lines
+//             are prefetched along a stride that was seen twice in a row
+//   stream    Up to 16 streams of misses to nearby lines, each going up or
+//             down; lines are prefetched ahead of a stream once its
+//             direction is confirmed
+//
+// The following options are used (see init_options in aca2009.h):
+//   --<name>-prefetch=<type>        Prefetcher, see above
+//   --<name>-prefetch-degree=<n>    Lines prefetched per trigger (default: 1)
+//   --<name>-prefetch-distance=<n>  Strides between the trigger and the
+//                                   first prefetched line (default: 1)
+//
+// The cache reports what became of the prefetches, which is registered in
+// the metrics (see metrics.h) "<name>.prefetch.issued", "<name>.prefetch.useful"
+// (prefetched lines hit by a demand access) and "<name>.prefetch.late"
+// (useful prefetches whose line had not arrived yet). Accuracy is useful
+// over issued prefetches, coverage is useful prefetches over the misses
+// there would have been without them.
+*/
+
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <stdint.h>
+#include <vector>
+
+class Prefetcher
+{
+public:
+    virtual ~Prefetcher() {}
+
+    // Trains on an access to addr, and appends the addresses of the lines
+    // to prefetch to lines
+    virtual void train(uint32_t addr, std::vector<uint32_t>& lines) = 0;
+
+    virtual const char* type() const = 0;
+
+    // Outcome of the prefetches, counted by the cache
+    void issued() { (*m_issued)++; }
+    void useful() { (*m_useful)++; }
+    void late()   { (*m_late)++; }
+
+    // Pretty-prints the accuracy, coverage and lateness, given the number
+    // of demand misses of the cache
+    void print(uint64_t misses) const;
+
+protected:
+    Prefetcher(const char* name, unsigned int line_size);
+
+    // Appends the lines distance to distance + degree - 1 strides from
+    // addr that are in the same page
+    void ahead(uint32_t addr, int32_t stride, std::vector<uint32_t>& lines) const;
+
+    unsigned int m_line_size;
+    unsigned int m_degree;
+    unsigned int m_distance;
+
+private:
+    uint64_t*    m_issued;
+    uint64_t*    m_useful;
+    uint64_t*    m_late;
+};
+
+/*
+ * Creates the prefetcher selected by the --<name>-prefetch option for a
+ * cache with lines of line_size bytes, or returns NULL for none. Caches
+ * with the same name share the metrics, e.g. the L1 caches of all CPUs.
+ */
+Prefetcher* prefetcher_create(const char* name, unsigned int line_size);
+
+#endif
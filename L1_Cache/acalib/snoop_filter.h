@@ -0,0 +1,90 @@
+/*
+// File: snoop_filter.h
+//
+// Snoop filter in front of the snoop port of an L1 cache. Most requests
+// that a cache snoops on the bus are for lines it does not hold, and the
+// filter answers those without a lookup in the tags: when it says a line is
+// not present, it is not. The cache tells the filter about every line it
+// fills and every line it drops (evicted, invalidated by a snoop or by the
+// caches below it), so that it covers all valid lines.
+//
+// The filter is a counting Bloom filter: each line address is hashed to a
+// few counters, which are incremented when the line is filled and
+// decremented when it is dropped. A line may be present only when all of
+// its counters are non-zero. Lines that share their counters with present
+// lines pass the filter as well, these are the false positives. A counter
+// that reaches its maximum stays there, so it can never drop to zero while
+// a line that uses it is present.
+//
+// Filters (the --<name>-snoop-filter option):
+//   none   Every snoop looks up the tags (default)
+//   bloom  Counting Bloom filter, see above
+//
+// The following options are used (see init_options in aca2009.h):
+//   --<name>-snoop-filter-ratio=<n>   Counters per line of the cache,
+//                                     rounded up to a power of two
+//                                     (default: 8)
+//   --<name>-snoop-filter-hashes=<n>  Counters per line address, 1 to 4
+//                                     (default: 2)
+//
+// The following metrics are registered (see metrics.h), shared by the
+// filters of all caches: "<name>.snoop_filter.snoops", "<name>.snoop_filter.filtered"
+// (snoops answered by the filter) and "<name>.snoop_filter.false_positives"
+// (snoops that passed the filter and missed in the tags).
+*/
+
+#ifndef SNOOP_FILTER_H
+#define SNOOP_FILTER_H
+
+#include <stdint.h>
+#include <vector>
+#include "metrics.h"
+
+class SnoopFilter
+{
+public:
+    // A filter of counters counters, a power of two, for a cache with lines
+    // of line_size bytes
+    SnoopFilter(const char* name, unsigned int counters, unsigned int hashes, unsigned int line_size);
+
+    // The cache filled the line holding addr
+    void insert(uint32_t addr);
+
+    // The cache dropped the line holding addr
+    void remove(uint32_t addr);
+
+    // Whether the line holding addr may be present, counted as a snoop
+    bool may_contain(uint32_t addr);
+
+    // A snoop that passed the filter missed in the tags
+    void false_positive() { (*m_false_positives)++; }
+
+    // Pretty-prints the filter rate of all filters with this name
+    void print() const;
+
+private:
+    // Index of counter i of the line holding addr
+    uint32_t index(uint32_t addr, unsigned int i) const
+    {
+        return ((addr >> m_offset_bits) * HASH_MULTIPLIERS[i]) >> m_shift;
+    }
+
+    static const uint32_t HASH_MULTIPLIERS[4];
+
+    std::vector<uint8_t> m_counters;
+    unsigned int         m_hashes;
+    unsigned int         m_offset_bits;
+    unsigned int         m_shift;       // 32 minus the bits of an index
+
+    uint64_t*            m_snoops;
+    uint64_t*            m_filtered;
+    uint64_t*            m_false_positives;
+};
+
+/*
+ * Creates the snoop filter given by the --<name>-snoop-filter option for a
+ * cache of lines lines of line_size bytes, or returns NULL for none.
+ */
+SnoopFilter* snoop_filter_create(const char* name, unsigned int lines, unsigned int line_size);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+// File: split_bus.cpp
+//
+// Timing of a split-transaction bus, see split_bus.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <stdio.h>
+#include "split_bus.h"
+#include "aca2009.h"
+
+using namespace std;
+
+SplitBus::SplitBus(const char* name, unsigned int outstanding, unsigned int data_cycles)
+    : m_slots(outstanding), m_count(0), m_data_cycles(data_cycles)
+{
+    if (outstanding == 0 || data_cycles == 0)
+    {
+        throw runtime_error("Error, a bus needs at least one transaction slot and a data cycle per line");
+    }
+
+    string prefix = string(name) + ".";
+    m_transactions = metrics_counter((prefix + "transactions").c_str(), "Transactions with a response");
+    m_stalls       = metrics_counter((prefix + "slot_stalls").c_str(), "Requests that found all slots in use");
+    m_stall_cycles = metrics_counter((prefix + "slot_stall_cycles").c_str(), "Cycles requests waited for a slot");
+    m_data_wait    = metrics_counter((prefix + "data_wait_cycles").c_str(), "Cycles responses waited for the data bus");
+    m_reordered    = metrics_counter((prefix + "reordered").c_str(), "Responses that overtook an earlier one");
+    m_occupancy    = metrics_histogram_create((prefix + "outstanding").c_str(), 1, outstanding + 1,
+                                              "Slots in use when a request arrives");
+}
+
+void SplitBus::retire(uint64_t now)
+{
+    // The slots in use are kept in the first m_count entries
+    for (unsigned int i = 0; i < m_count; )
+    {
+        if (m_slots[i] <= now)
+        {
+            m_slots[i] = m_slots[--m_count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    // Responses are never ready before now, so older reservations can go
+    size_t old = 0;
+    while (old < m_transfers.size() && m_transfers[old].end <= now)
+    {
+        old++;
+    }
+    m_transfers.erase(m_transfers.begin(), m_transfers.begin() + old);
+}
+
+uint64_t SplitBus::reserve_data(uint64_t ready)
+{
+    // First gap of m_data_cycles at or after ready
+    uint64_t start = ready;
+    size_t   i     = 0;
+    while (i < m_transfers.size() && m_transfers[i].start < start + m_data_cycles)
+    {
+        if (m_transfers[i].end > start)
+        {
+            start = m_transfers[i].end;
+        }
+        i++;
+    }
+
+    transfer t = { start, start + m_data_cycles };
+    m_transfers.insert(m_transfers.begin() + i, t);
+    *m_data_wait += start - ready;
+    return t.end;
+}
+
+uint64_t SplitBus::issue(uint64_t now, unsigned int latency, uint64_t& start)
+{
+    retire(now);
+    metrics_histogram_add(m_occupancy, m_count);
+    (*m_transactions)++;
+
+    start = now;
+    if (m_count == m_slots.size())
+    {
+        uint64_t first = m_slots[0];
+        for (unsigned int i = 1; i < m_count; i++)
+        {
+            first = (m_slots[i] < first) ? m_slots[i] : first;
+        }
+        start = first;
+        (*m_stalls)++;
+        *m_stall_cycles += start - now;
+        retire(start);
+    }
+
+    uint64_t done = reserve_data(start + latency);
+    for (unsigned int i = 0; i < m_count; i++)
+    {
+        if (m_slots[i] > done)
+        {
+            (*m_reordered)++;
+            break;
+        }
+    }
+    m_slots[m_count++] = done;
+    return done;
+}
+
+void SplitBus::print() const
+{
+    printf("Split bus: %u slots, %llu transactions, %llu stalled on a slot (%llu cycles), "
+           "%llu cycles waiting for data, %llu reordered, median outstanding %llu\n",
+           (unsigned int) m_slots.size(), (unsigned long long) *m_transactions,
+           (unsigned long long) *m_stalls, (unsigned long long) *m_stall_cycles,
+           (unsigned long long) *m_data_wait, (unsigned long long) *m_reordered,
+           (unsigned long long) metrics_histogram_percentile(m_occupancy, 0.5));
+}
+
+SplitBus* split_bus_create(const char* name, unsigned int line_size)
+{
+    string       prefix      = string(name) + "-";
+    unsigned int outstanding = (unsigned int) option_int((prefix + "outstanding").c_str(), 8);
+    unsigned int width       = (unsigned int) option_int((prefix + "width").c_str(), 32);
+    if (width == 0)
+    {
+        throw runtime_error("Error, the data bus needs a width");
+    }
+    unsigned int cycles = (line_size + width - 1) / width;
+    return new SplitBus(name, outstanding, cycles ? cycles : 1);
+}
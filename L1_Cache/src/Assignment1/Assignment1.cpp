@@ -30,38 +30,82 @@
 */
 
 #include "aca2009.h"
+#include "metrics.h"
+#include "acalog.h"
+// The TLM utility sockets spawn processes
+#define SC_INCLUDE_DYNAMIC_PROCESSES
 #include <systemc.h>
+#include "cache_model.h"
+#include "cache_hierarchy.h"
+#include "backing_store.h"
+#include "write_buffer.h"
+#include "mshr.h"
+#include "prefetcher.h"
+#include <tlm.h>
+#include <tlm_utils/simple_initiator_socket.h>
+#include <tlm_utils/simple_target_socket.h>
+#include <tlm_utils/tlm_quantumkeeper.h>
 #include <iostream>
-
-#define TAG_CHECK 0xFFFFF000
-#define SET_CHECK 0x00000FE0
-#define OFF_CHECK 0x0000001F
+#include <vector>
 
 #define READ 0
 #define WRITE 1
 
 using namespace std;
 
-static const int MAX_CACHE_ENTRIES 	= 128;
-static const int MAX_CACHE_SIZE 	= 32768; 	//32KB
-static const int CACHE_LINE_SIZE 	= 32; 		//32 bytes
-static const int MAX_SET 		= 8;
+// Default geometry: 32KB, 8-way set-associative, 32 byte lines, tree pseudo-LRU,
+// see --l1-size, --l1-ways, --l1-line and --l1-policy
+static const unsigned int L1_SIZE	= 32768;
+static const unsigned int L1_WAYS	= 8;
+static const unsigned int L1_LINE	= 32;
 
+// Write-back buffer of 8 lines, write misses allocate a line,
+// see --l1-wb-entries and --l1-no-write-allocate
+static const unsigned int L1_WB_ENTRIES	= 8;
+
+// 8 MSHRs, the CPU waits for each request before the next one, see
+// --l1-mshrs and --cpu-outstanding
+static const unsigned int L1_MSHRS	= 8;
+static const unsigned int CPU_OUTSTANDING	= 1;
+
+// The CPU drives the signals of the cache, see --tlm and --quantum for the
+// loosely-timed transaction-level interface and its quantum in cycles
+static const unsigned int TLM_QUANTUM	= 1000;
+
+// Length of a clock cycle. The modules wait for a number of cycles instead
+// of counting clock edges, so the simulation skips the idle cycles.
+static const sc_time CLOCK_PERIOD(1, SC_NS);
+
+// Line states, a dirty line is valid and differs from memory, a prefetched
+// line is valid and was not accessed since a prefetch brought it in
+static const int LINE_INVALID	= 0;
+static const int LINE_VALID	= 1;
+static const int LINE_DIRTY	= 2;
+static const int LINE_PREFETCHED	= 3;
 
-typedef struct {
-	//cache fields - Data, Valid, tag
-        unsigned int c_data[8];
-        unsigned int c_valid:1;
-        unsigned int c_tag:20;
-} cache_data;
-   
-typedef struct 
-    {
-        unsigned int lru:7;                     // 7 bit representation
-        cache_data way[MAX_SET];        	// 8
 
-    } cache_set;
+/*
+ * Extension of a TLM transaction that returns the number of cycles after
+ * the transport until the data of a miss arrives, see Port_Latency.
+ */
+struct access_latency : public tlm::tlm_extension<access_latency>
+{
+    unsigned int cycles;
+
+    access_latency() : cycles(0) {}
+
+    tlm::tlm_extension_base* clone() const
+    {
+        access_latency* ext = new access_latency();
+        ext->cycles = cycles;
+        return ext;
+    }
 
+    void copy_from(const tlm::tlm_extension_base& other)
+    {
+        cycles = static_cast<const access_latency&>(other).cycles;
+    }
+};
 
 SC_MODULE(Memory) 
 {
@@ -80,40 +124,83 @@ public:
     };
 	
 
-    sc_in<bool>     Port_CLK;
     sc_in<Function> Port_Func;
     sc_in<int>      Port_Addr;
     sc_out<RetCode> Port_Done;
     sc_inout_rv<32> Port_Data;
+    sc_out<int>     Port_Latency;	// cycles until the data of a request arrives, 0 on a hit
 
-    void update_lru(int line, int way);
-    int lru_call(int line);
-    int cache_operation(int addr, int mode);
+    // Loosely-timed interface, used instead of the signals with --tlm
+    tlm_utils::simple_target_socket<Memory> socket;
+
+    bool access(int addr, int mode, int& ret_data);
+    unsigned int operation(int addr, int mode, int value, uint64_t now, int& ret_data,
+                           unsigned int& latency);
+    int cache_operation(int addr, int mode, int value, unsigned int& latency);
+    void b_transport(tlm::tlm_generic_payload& trans, sc_time& delay);
+    uint64_t fast_forward(uint64_t count, stats_sample& warmup);
+    static bool back_invalidate(void* mem, uint32_t addr);
+
+    // Caches below the L1, see cache_hierarchy.h
+    const CacheHierarchy& hierarchy() const { return *m_hierarchy; }
+    const WriteBuffer& write_buffer() const { return *m_wbuf; }
+    const MSHRFile& mshrs() const { return *m_mshr; }
+    const Prefetcher* prefetcher() const { return m_prefetcher; }
 
     SC_CTOR(Memory) 
     {
         SC_THREAD(execute);
-        sensitive << Port_CLK.pos();
-        dont_initialize();
-        m_data = new cache_set[MAX_CACHE_SIZE /( MAX_SET * CACHE_LINE_SIZE)];
-        for (int i = 0; i < MAX_CACHE_ENTRIES ; i++)
-        {
-            for (int j = 0; j < MAX_SET ; j++)
-            {
-                m_data[i].way[j].c_tag = 0xFFFFF;
-            }
-        }	
+        socket.register_b_transport(this, &Memory::b_transport);
+        m_warmup = NULL;
+        m_cache = cache_create("l1", L1_SIZE, L1_WAYS, L1_LINE, LINE_INVALID);
+        m_hierarchy = new CacheHierarchy(1, m_cache->line_size());
+        m_hierarchy->attach(0, back_invalidate, this);
+        m_store = new BackingStore();
+        m_wbuf = new WriteBuffer("l1", (unsigned int) option_int("l1-wb-entries", L1_WB_ENTRIES),
+                                 m_hierarchy->memory_latency());
+        m_write_allocate = !option_flag("l1-no-write-allocate");
+        m_mshr = new MSHRFile("l1", (unsigned int) option_int("l1-mshrs", L1_MSHRS));
+        m_fetched = false;
+        m_prefetcher = prefetcher_create("l1", m_cache->line_size());
+        m_prefetch_hit = false;
+        m_wb_pending = 0;
+        m_miss_latency = 0;
    }
 
     ~Memory() 
     {
-        delete m_data;
+        delete m_prefetcher;
+        delete m_mshr;
+        delete m_wbuf;
+        delete m_store;
+        delete m_hierarchy;
+        delete m_cache;
     }
 
 private:
 
-    cache_set* m_data;
+    CacheArray* m_cache;
+    CacheHierarchy* m_hierarchy;
+    BackingStore* m_store;	// contents of main memory
+    WriteBuffer* m_wbuf;	// timing of the write-backs to memory
+    bool m_write_allocate;	// whether a write miss fills a line
+    unsigned int m_wb_pending;	// write-backs of the last access, not yet in the buffer
+    MSHRFile* m_mshr;	// timing of the outstanding misses
+    bool m_fetched;	// whether the last access fetched a line
+    Prefetcher* m_prefetcher;	// NULL without prefetching
+    std::vector<uint32_t> m_prefetches;	// lines to prefetch after the last access
+    bool m_prefetch_hit;	// whether the last access was the first to a prefetched line
+    unsigned int m_miss_latency;	// cycles the last miss took below the L1
+    stats_sample* m_warmup;
     int data;
+
+    void count(int mode, bool hit);
+    unsigned int fetch(int addr, uint32_t set, int way);
+    void train(int addr);
+    void prefetch_hit(int addr, uint32_t set, int way);
+    void prefetch(const uint64_t* now);
+    void write_back(uint32_t set, int way);
+    void queue_write_back();
     void execute() 
     {
         while (true)
@@ -124,10 +211,11 @@ private:
             int addr   = Port_Addr.read();
             int data   = 0;
 	    int cache_data;
+	    unsigned int latency;
 			
             if (f == FUNC_WRITE) 
             {
-                cout << sc_time_stamp() << ": CACHE received write" << endl;
+                LOG_DEBUG(LOG_CACHE, sc_time_stamp() << ": CACHE received write");
                 data = Port_Data.read().to_int();
             }
 
@@ -136,238 +224,566 @@ private:
 			
 	    if (f == FUNC_READ) 
             {
-                cache_data = cache_operation(addr, READ);
+                cache_data = cache_operation(addr, READ, 0, latency);
                 Port_Data.write( cache_data );
+                Port_Latency.write( latency );
                 Port_Done.write( RET_READ_DONE );
-                wait();
+                wait(CLOCK_PERIOD);
                 Port_Data.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
             }
             else
             {
-                cache_data = cache_operation(addr, WRITE);
-                cout << "Data " << data <<" is written at " << addr  << endl;
+                cache_data = cache_operation(addr, WRITE, data, latency);
+                LOG_DEBUG(LOG_CACHE, "Data " << data << " is written at " << addr);
+                Port_Latency.write( latency );
                 Port_Done.write( RET_WRITE_DONE );
             }
         }
     }
 };
 		
-    int Memory::cache_operation(int addr, int mode)
+    // Functional part of an access: looks up and updates the tags, data and
+    // LRU state without advancing the simulated time. Returns whether the
+    // access hit, ret_data holds the read data.
+    bool Memory::access(int addr, int mode, int& ret_data)
 	{
 		//Check if the address is available in the cache by comparing the TAG
 		// if tag match == HIT otherwise MISS
-		int i = 0; 
-		int ret_data = 0 ;
-		int found = 0;
-		unsigned int tag = (addr & TAG_CHECK) >> 12;
-		unsigned int set = (addr & SET_CHECK) >> 5;
-		unsigned int word = (addr & OFF_CHECK) >> 2;
-		int pid = 0;
-		data = 0;
-		if ( mode == 0 ) //READ
+		uint32_t set = m_cache->set_of(addr);
+		uint32_t tag = m_cache->tag_of(addr);
+		uint32_t word = m_cache->word_of(addr);
+		int way = m_cache->find(set, tag);
+		ret_data = 0;
+		if ( mode == READ )
 		{
 		//	READ MODE CHECK FOR TAG MATCH, IF TAG MATCHES THEN CHECK VALID.
 		//  IF VALID BLOCK IS FOUND, THEN RETURN THE VALUE OTHERWISE IT IS A READ MISS
-			for (i=0; i < MAX_SET; i++)
+			if (way >= 0 && m_cache->state(set, way) != LINE_INVALID)
 			{
-				if ((m_data[set].way[i].c_tag == tag)  && (found == 0))
-				{
-					if ( m_data[set].way[i].c_valid == 1)
-					{
-						cout << "*** Read Hit - Valid Data is found ***" << endl;
-						found = 1;
-						ret_data = m_data[set].way[i].c_data[word];
-						update_lru(set, i);
-						stats_readhit(pid);
-						wait();
-						break;	
-					}
-					else
-					{
-						// READ MISS, COPY THE DATA FROM MAIN MEMORY
-						cout << " *** Read Miss - Data is not valid, copy data from Memory ***" << endl;
-						stats_readmiss(pid);
-						wait(100);
-						m_data[set].way[i].c_data[word] = rand();
-						m_data[set].way[i].c_valid = 1;
-						ret_data = m_data[set].way[i].c_data[word];
-						found = 1;
-						// update LRU
-						update_lru(set, i);
-						break;
-					}
-				}
+				LOG_DEBUG(LOG_CACHE, "*** Read Hit - Valid Data is found ***");
+				ret_data = m_cache->data(set, way)[word];
+				m_cache->touch(set, way);
+				prefetch_hit(addr, set, way);
+				count(READ, true);
+				return true;
 			}
-			if (found == 0)
+			if (way >= 0)
 			{
-				//READ MISS, GET THE DATA FROM MEMORY AND REPLACE ONE LINE FROM CACHE USING LRU
-				//GET THE WAY TO BE UPDATED THROUGH LRU
-				cout << " *** Read Miss - Data is stale, Copy from memory ***" << endl;
-				stats_readmiss(pid);
-				wait(100);
-				int selected_way = lru_call(set) ;	//lru???
-				m_data[set].way[selected_way].c_data[word] = rand();
-				m_data[set].way[selected_way].c_valid = 1;
-				m_data[set].way[selected_way].c_tag = tag;
-				//update LRU table
-				update_lru(set, selected_way);
-				ret_data = m_data[set].way[selected_way].c_data[word];
-				found = 1;		
+				// READ MISS, COPY THE DATA FROM MAIN MEMORY
+				LOG_DEBUG(LOG_CACHE, " *** Read Miss - Data is not valid, copy data from Memory ***");
 			}
-			return ret_data	;	
+			else
+			{
+				//READ MISS, GET THE DATA FROM MEMORY AND FILL AN INVALID WAY OR THE POLICY'S VICTIM
+				LOG_DEBUG(LOG_CACHE, " *** Read Miss - Data is stale, Copy from memory ***");
+				way = m_cache->victim(set);
+				LOG_TRACE(LOG_CACHE, " Way Selected by " << m_cache->policy() << " is " << way);
+			}
+			m_miss_latency = fetch(addr, set, way);
+			m_fetched = true;
+			// fill also updates the replacement state
+			m_cache->fill(set, way, tag, LINE_VALID);
+			train(addr);
+			ret_data = m_cache->data(set, way)[word];
+			count(READ, false);
+			return false;
 		}		
 		else
 		// NEED TO PERFORM WRITE OPERATION
 		{	
-			for (i=0; i < MAX_SET; i++)
+			if (way >= 0 && m_cache->state(set, way) != LINE_INVALID)
 			{
-				if ((m_data[set].way[i].c_tag == tag)  && (found == 0))
-				{
-					cout << " Cache write Hit" << endl;
-					m_data[set].way[i].c_data[word] = data;
-					stats_writehit(0);
-					m_data[set].way[i].c_valid = 1;
-					//update LRU
-					update_lru(set, i);
-					found = 1;
-					ret_data = m_data[set].way[i].c_data[word];
-					wait();
-					break ;
-				}
+				LOG_DEBUG(LOG_CACHE, " Cache write Hit");
+				prefetch_hit(addr, set, way);
+				m_cache->data(set, way)[word] = data;
+				m_cache->set_state(set, way, LINE_DIRTY);
+				//update replacement state
+				m_cache->touch(set, way);
+				count(WRITE, true);
+				return true;
+			}
+			//WRITE MISS, HENCE GET A BLOCK ADDRESS FROM THE REPLACEMENT POLICY
+			LOG_DEBUG(LOG_CACHE, "Cache Write Miss ");
+			if (!m_write_allocate)
+			{
+				// The word goes around the cache, through the write-back buffer
+				m_store->write_word(addr, data);
+				queue_write_back();
+				count(WRITE, false);
+				return false;
 			}
-			if (found == 0)
+			// An invalidated copy of the line is refilled in place
+			if (way < 0)
 			{
-				//WRITE MISS, HENCE GET A BLOCK ADDRESS THROUGH LRU LOOK UP TABLE
-				cout << "Cache Write Miss " << endl;
-            			stats_writemiss(0);
-				wait(100);
-				int selected_way = lru_call(set);
-				cout << " Way Selected by LRU Look Up Table is " << selected_way <<endl;
-				m_data[set].way[selected_way].c_data[word] = rand();
-				m_data[set].way[selected_way].c_valid = 1;
-				m_data[set].way[selected_way].c_tag = tag;
-				//update LRU LUT
-				update_lru(set, selected_way);
-				//found = 1;	
+				way = m_cache->victim(set);
+				LOG_TRACE(LOG_CACHE, " Way Selected by " << m_cache->policy() << " is " << way);
 			}
-			return 0;
+			m_miss_latency = fetch(addr, set, way);
+			m_fetched = true;
+			m_cache->fill(set, way, tag, LINE_DIRTY);
+			train(addr);
+			m_cache->data(set, way)[word] = data;
+			count(WRITE, false);
+			return false;
 		}	
 
-	}  // END OF cache_operation();
-	
-int Memory::lru_call(int line) 
+	}  // END OF access();
+
+    // Hands the line in the way about to be filled to the levels below the
+    // L1, and fetches the line holding addr from them into the way. Returns
+    // the number of cycles the levels below the L1 take.
+    unsigned int Memory::fetch(int addr, uint32_t set, int way)
 	{
-    		int present_state = m_data[line].lru;
-    		cout << "Present State for line "<< line << "is : " << present_state <<endl; 
-    		if( (present_state & 0xB ) == 0)
-    		{
-        		return 0;
-    		} else if( (present_state & 0xB ) == 0x8 ) 
-    		{
-        		return 1;
-    		} else if ( (present_state & 0x13 ) == 0x2 )
-    		{
-        		return 2;
-		} else if ( (present_state & 0x13 ) == 0x12 )
-    		{
-        		return 3;
-    		} else if ( (present_state & 0x25 ) == 0x1 )
-    		{
-        		return 4;
-    		} else if ( (present_state & 0x25 ) == 0x21 ) 
-    		{
-        		return 5;
-    		} else if ( (present_state & 0x45 ) == 0x5 )
-    		{
-        		return 6;
-	    	} else if ( (present_state & 0x45 ) == 0x45 )
-    		{
-        		return 7;
-    		}
-    		else 
+		if (m_cache->state(set, way) != LINE_INVALID)
 		{
-        		cout << "Something wrong in finding LRU Way :( "<< endl;
-        		return 0;  
-    		}
+			if (m_cache->state(set, way) == LINE_DIRTY)
+			{
+				write_back(set, way);
+				queue_write_back();
+			}
+			m_hierarchy->evict(0, m_cache->addr_of(set, m_cache->tag(set, way)));
+			// The victim is gone before the fill below the L1, which may
+			// back-invalidate it and must not write it back again
+			m_cache->set_state(set, way, LINE_INVALID);
+		}
+		unsigned int latency = m_hierarchy->miss(0, addr);
+		m_store->read_line(addr & ~(m_cache->line_size() - 1), m_cache->data(set, way),
+		                   m_cache->line_size() / 4);
+		return latency;
+	}
 
-		
+    // Trains the prefetcher on a miss
+    void Memory::train(int addr)
+	{
+		if (m_prefetcher != NULL)
+		{
+			m_prefetcher->train(addr, m_prefetches);
+		}
+	}
+
+    // Counts the first access to a prefetched line as a useful prefetch,
+    // which also trains the prefetcher
+    void Memory::prefetch_hit(int addr, uint32_t set, int way)
+	{
+		if (m_cache->state(set, way) == LINE_PREFETCHED)
+		{
+			m_prefetcher->useful();
+			m_prefetch_hit = true;
+			m_cache->set_state(set, way, LINE_VALID);
+			m_prefetcher->train(addr, m_prefetches);
+		}
+	}
+
+    // Fetches the lines the prefetcher asked for. The timed model gives each
+    // prefetch an MSHR at cycle *now, and drops the prefetches that find all
+    // MSHRs in use rather than stalling the cache.
+    void Memory::prefetch(const uint64_t* now)
+	{
+		for (size_t i = 0; i < m_prefetches.size(); i++)
+		{
+			uint32_t line = m_prefetches[i];
+			if (m_cache->lookup(line) >= 0)
+			{
+				continue;
+			}
+			if (now != NULL && m_mshr->full(*now))
+			{
+				break;
+			}
+			uint32_t set = m_cache->set_of(line);
+			int way = m_cache->victim(set);
+			unsigned int latency = fetch(line, set, way);
+			m_cache->fill(set, way, m_cache->tag_of(line), LINE_PREFETCHED);
+			m_prefetcher->issued();
+			if (now != NULL)
+			{
+				uint64_t done;
+				m_mshr->allocate(line, *now, latency, done);
+			}
+		}
+		m_prefetches.clear();
+	}
+
+    // Copies a dirty line to main memory
+    void Memory::write_back(uint32_t set, int way)
+	{
+		m_store->write_line(m_cache->addr_of(set, m_cache->tag(set, way)), m_cache->data(set, way),
+		                    m_cache->line_size() / 4);
 	}
 
-void Memory::update_lru(int line, int way)
+    // Puts a write-back in the write-back buffer when the access completes,
+    // the functional model only counts it
+    void Memory::queue_write_back()
 	{
-		cout << " LRU way is: " << way << " and present LRU is " << m_data[line].lru << endl; 
-        	if ( way == 0 ) //NS  xxx1x11
+		if (m_warmup != NULL)
+		{
+			m_wbuf->count();
+		}
+		else
 		{
-            		m_data[line].lru = m_data[line].lru | 0xB;
-        	}
-        	else if ( way == 1 )
-		{ // L1 is replaced. Next state xxx0x11
-            		m_data[line].lru = m_data[line].lru | 0x3;
-            		m_data[line].lru = m_data[line].lru & 0x77; 
-        	}
-        	else if ( way == 2 )
-		{ // NS xx1xx01
-            		m_data[line].lru = m_data[line].lru | 0x11; 
-            		m_data[line].lru = m_data[line].lru & 0x7D; 
-        	}
-		else if ( way == 3 )
-        	{ // NS  xx0xx01
-              		m_data[line].lru = m_data[line].lru | 0x1;
-              		m_data[line].lru = m_data[line].lru & 0x6D;
-        	}
-        	else if( way ==4) 
-		{// NS x1xx1x0
-              		m_data[line].lru = m_data[line].lru | 0x24; 
-              		m_data[line].lru = m_data[line].lru & 0x7E; 
-        	}
-        	else if ( way == 5 ) // NS x0xx1x0
-        	{      
-			m_data[line].lru = m_data[line].lru | 0x4; 
-              		m_data[line].lru = m_data[line].lru & 0x5E; 
-        	}
-        	else if ( way == 6 )
-		{ // NS 1xxx0x0
-              		m_data[line].lru = m_data[line].lru | 0x40; 
-              		m_data[line].lru = m_data[line].lru & 0x7A; 
-        	}
-        	else if ( way ==7 ) 
-		{ // NS 0xxx0x0    
-              		m_data[line].lru = m_data[line].lru & 0x3A;    
-        	} 
-        	else
-              		cout << "Something wrong with LRU update"<< endl;
-
-		cout << " LRU way is: " << way << " and LRU is updated to " << m_data[line].lru << endl; 
+			m_wb_pending++;
+		}
+	}
 
+    // Removes a line from the L1 when an inclusive L2 or L3 evicts it
+    bool Memory::back_invalidate(void* mem, uint32_t addr)
+	{
+		CacheArray* cache = ((Memory*) mem)->m_cache;
+		int way = cache->lookup(addr);
+		if (way < 0)
+		{
+			return false;
+		}
+		if (cache->state(cache->set_of(addr), way) == LINE_DIRTY)
+		{
+			((Memory*) mem)->write_back(cache->set_of(addr), way);
+			((Memory*) mem)->m_wbuf->count();
+		}
+		cache->set_state(cache->set_of(addr), way, LINE_INVALID);
+		return true;
 	}
 
-		
+    /*
+     * Timing of an access at cycle now. The cache takes a cycle per request,
+     * plus the stalls when the write-back buffer is full or all MSHRs are in
+     * use, and then goes on with the next request; returns the number of
+     * cycles it takes. A miss allocates an MSHR, or merges into the one of
+     * its line; latency is set to the number of cycles after that until its
+     * line arrives, 0 for a hit. The data is returned right away in ret_data,
+     * the functional model already holds it. Prefetches are issued after the
+     * miss that triggered them.
+     */
+    unsigned int Memory::operation(int addr, int mode, int value, uint64_t now, int& ret_data,
+                                   unsigned int& latency)
+	{
+		ret_data = 0;
+		data = value;
+		uint32_t line = addr & ~(m_cache->line_size() - 1);
+		uint64_t done = 0;
+		bool merged = m_mshr->merge(line, now, done);
+		m_fetched = false;
+		m_prefetch_hit = false;
+		access(addr, mode, ret_data);
+
+		unsigned int stall = 0;
+		if (m_fetched && !merged)
+		{
+			stall += m_mshr->allocate(line, now, m_miss_latency, done);
+		}
+		if (merged && m_prefetch_hit)
+		{
+			m_prefetcher->late();
+		}
+		uint64_t issue = now + stall;
+		prefetch(&issue);
 
+		for (; m_wb_pending > 0; m_wb_pending--)
+		{
+			stall += m_wbuf->push(now + stall);
+		}
+		if (stall > 0)
+		{
+			LOG_DEBUG(LOG_CACHE, "Write-back buffer or MSHRs full, stalling " << stall << " cycles");
+		}
+
+		now += stall + 1;
+		latency = (done > now) ? (unsigned int) (done - now) : 0;
+		return stall + 1;
+	}
+
+    // Access through the signal interface, waits while the cache is busy
+    int Memory::cache_operation(int addr, int mode, int value, unsigned int& latency)
+	{
+		int ret_data;
+		uint64_t now = sc_time_stamp().value() / 1000;
+		wait(CLOCK_PERIOD * operation(addr, mode, value, now, ret_data, latency));
+		return (mode == READ) ? ret_data : 0;
+	}
+
+    /*
+     * Access through the TLM socket. The time the cache takes is added to
+     * the delay instead of waited for, the initiator runs ahead of the
+     * simulation by the delay. The latency of a miss is returned in the
+     * access_latency extension, if the initiator set one.
+     */
+    void Memory::b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
+	{
+		if (trans.get_data_length() != 4 || (trans.get_address() & 3) != 0)
+		{
+			trans.set_response_status(tlm::TLM_BURST_ERROR_RESPONSE);
+			return;
+		}
+
+		int* ptr = (int*) trans.get_data_ptr();
+		int mode = trans.is_write() ? WRITE : READ;
+		int ret_data;
+		unsigned int latency;
+		uint64_t now = (sc_time_stamp() + delay).value() / 1000;
+		delay += CLOCK_PERIOD * operation((int) trans.get_address(), mode, (mode == WRITE) ? *ptr : 0,
+		                                  now, ret_data, latency);
+		if (mode == READ)
+		{
+			*ptr = ret_data;
+		}
+
+		access_latency* ext;
+		trans.get_extension(ext);
+		if (ext != NULL)
+		{
+			ext->cycles = latency;
+		}
+		trans.set_response_status(tlm::TLM_OK_RESPONSE);
+	}
+
+    // Counts an access, in the warm-up counters while fast-forwarding
+    void Memory::count(int mode, bool hit)
+	{
+		if (m_warmup != NULL)
+		{
+			if (mode == READ)
+			{
+				(hit ? m_warmup->readhit : m_warmup->readmiss)++;
+			}
+			else
+			{
+				(hit ? m_warmup->writehit : m_warmup->writemiss)++;
+			}
+		}
+		else if (mode == READ)
+		{
+			hit ? stats_readhit(0) : stats_readmiss(0);
+		}
+		else
+		{
+			hit ? stats_writehit(0) : stats_writemiss(0);
+		}
+	}
+
+    /*
+     * Runs up to count trace entries of CPU 0 through the functional model,
+     * without SystemC, and returns how many were run. The hits and misses
+     * are counted in warmup instead of the statistic counters; the caller
+     * resets the other metrics if the detailed run follows.
+     */
+    uint64_t Memory::fast_forward(uint64_t count, stats_sample& warmup)
+	{
+		static const size_t BATCH = 4096;
+		TraceFile::Entry entries[BATCH];
+		uint64_t done = 0;
+		int ret_data;
+
+		memset(&warmup, 0, sizeof(warmup));
+		m_warmup = &warmup;
+		data = 0;
+		while (done < count)
+		{
+			size_t n = tracefile_ptr->next_batch(0, entries,
+			                                     (size_t) min<uint64_t>(BATCH, count - done));
+			if (n == 0)
+			{
+				break;
+			}
+			for (size_t i = 0; i < n; i++)
+			{
+				if (entries[i].type == TraceFile::ENTRY_TYPE_READ)
+				{
+					access(entries[i].addr, READ, ret_data);
+				}
+				else if (entries[i].type == TraceFile::ENTRY_TYPE_WRITE)
+				{
+					access(entries[i].addr, WRITE, ret_data);
+				}
+				prefetch(NULL);
+			}
+			done += n;
+		}
+		m_warmup = NULL;
+
+		// Prefetches of the warm-up are not counted, so neither are hits on
+		// the lines they brought in
+		for (uint32_t set = 0; set < m_cache->sets(); set++)
+		{
+			for (unsigned int way = 0; way < m_cache->ways(); way++)
+			{
+				if (m_cache->state(set, way) == LINE_PREFETCHED)
+				{
+					m_cache->set_state(set, way, LINE_VALID);
+				}
+			}
+		}
+		return done;
+	}
 	
 SC_MODULE(CPU) 
 {
 
 public:
-    sc_in<bool>                Port_CLK;
     sc_in<Memory::RetCode>   Port_MemDone;
     sc_out<Memory::Function> Port_MemFunc;
     sc_out<int>                Port_MemAddr;
     sc_inout_rv<32>            Port_MemData;
+    sc_in<int>                 Port_MemLatency;
+
+    // Loosely-timed interface, used instead of the signals with --tlm
+    tlm_utils::simple_initiator_socket<CPU> socket;
 
     SC_CTOR(CPU) 
     {
         SC_THREAD(execute);
-        sensitive << Port_CLK.pos();
-        dont_initialize();
+        m_tlm = option_flag("tlm");
+        tlm::tlm_global_quantum::instance().set(CLOCK_PERIOD * (double) option_int("quantum", TLM_QUANTUM));
+        m_qk.reset();
+        m_max_outstanding = (unsigned int) option_int("cpu-outstanding", CPU_OUTSTANDING);
+        if (m_max_outstanding == 0)
+        {
+            throw runtime_error("Error, the CPU needs at least one outstanding request");
+        }
+        m_issue_stalls = metrics_counter("cpu0.issue_stalls", "Cycles waiting for an outstanding request");
     }
 
 private:
+    std::vector<uint64_t> m_outstanding;	// cycles at which the outstanding requests complete
+    unsigned int m_max_outstanding;
+    uint64_t* m_issue_stalls;
+    bool m_tlm;	// whether the CPU uses the TLM socket
+    tlm_utils::tlm_quantumkeeper m_qk;	// time the CPU runs ahead with the TLM socket
+
+    // Current cycle of the CPU, which runs ahead of the simulation with the
+    // TLM socket
+    uint64_t cycle() const
+    {
+        sc_time now = sc_time_stamp();
+        if (m_tlm)
+        {
+            now += m_qk.get_local_time();
+        }
+        return now.value() / 1000;
+    }
+
+    // Lets cycles pass, in the local time of the CPU with the TLM socket,
+    // which is synchronized with the simulation once every quantum
+    void advance(uint64_t cycles)
+    {
+        if (!m_tlm)
+        {
+            wait(CLOCK_PERIOD * (double) cycles);
+            return;
+        }
+        m_qk.inc(CLOCK_PERIOD * (double) cycles);
+        if (m_qk.need_sync())
+        {
+            m_qk.sync();
+        }
+    }
+
+    // Removes the requests that complete by the current cycle, and returns the cycle
+    uint64_t retire()
+    {
+        uint64_t now = cycle();
+        for (size_t i = 0; i < m_outstanding.size(); )
+        {
+            if (m_outstanding[i] <= now)
+            {
+                m_outstanding[i] = m_outstanding.back();
+                m_outstanding.pop_back();
+            }
+            else
+            {
+                i++;
+            }
+        }
+        return now;
+    }
+
+    // Waits until fewer than limit requests are outstanding
+    void wait_outstanding(unsigned int limit)
+    {
+        uint64_t now = retire();
+        while (m_outstanding.size() >= limit && !m_outstanding.empty())
+        {
+            uint64_t oldest = m_outstanding[0];
+            for (size_t i = 1; i < m_outstanding.size(); i++)
+            {
+                oldest = min(oldest, m_outstanding[i]);
+            }
+            *m_issue_stalls += oldest - now;
+            advance(oldest - now);
+            now = retire();
+        }
+    }
+
+    // Request through the signals, returns when the cache has taken it
+    void signal_access(Memory::Function f, int addr)
+    {
+        Port_MemAddr.write(addr);
+        Port_MemFunc.write(f);
+
+        if (f == Memory::FUNC_WRITE) 
+        {
+            LOG_DEBUG(LOG_CPU, sc_time_stamp() << ": CPU sends write");
+
+            Port_MemData.write(rand());
+            wait(CLOCK_PERIOD);
+            Port_MemData.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+        }
+        else
+        {
+            LOG_DEBUG(LOG_CPU, sc_time_stamp() << ": CPU sends read");
+        }
+
+        wait(Port_MemDone.value_changed_event());
+
+        // The request stays outstanding until its data arrives
+        if (Port_MemLatency.read() > 0)
+        {
+            m_outstanding.push_back(sc_time_stamp().value() / 1000 + Port_MemLatency.read());
+        }
+
+        if (f == Memory::FUNC_READ)
+        {
+            LOG_DEBUG(LOG_CPU, sc_time_stamp() << ": CPU reads: " << Port_MemData.read());
+        }
+    }
+
+    // Request through the TLM socket, which returns at once with the time
+    // the cache took added to the local time of the CPU
+    void transport(Memory::Function f, int addr)
+    {
+        int data = (f == Memory::FUNC_WRITE) ? rand() : 0;
+        access_latency latency;
+        tlm::tlm_generic_payload trans;
+        trans.set_command((f == Memory::FUNC_WRITE) ? tlm::TLM_WRITE_COMMAND : tlm::TLM_READ_COMMAND);
+        trans.set_address(addr);
+        trans.set_data_ptr((unsigned char*) &data);
+        trans.set_data_length(4);
+        trans.set_streaming_width(4);
+        trans.set_byte_enable_ptr(NULL);
+        trans.set_dmi_allowed(false);
+        trans.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+        trans.set_extension(&latency);
+
+        sc_time delay = m_qk.get_local_time();
+        socket->b_transport(trans, delay);
+        m_qk.set(delay);
+        trans.clear_extension(&latency);
+        if (trans.is_response_error())
+        {
+            throw runtime_error("Error, the cache refused an access");
+        }
+
+        if (latency.cycles > 0)
+        {
+            m_outstanding.push_back(cycle() + latency.cycles);
+        }
+        LOG_DEBUG(LOG_CPU, cycle() << ": CPU " << ((f == Memory::FUNC_READ) ? "reads: " : "writes: ") << data);
+    }
+
     void execute() 
     {
         TraceFile::Entry    tr_data;
         Memory::Function  f;
 	//int addr, data, pid=0;
-        int addr, data;
+        int addr;
         // Loop until end of tracefile
         while(!tracefile_ptr->eof())
         {
@@ -404,39 +820,32 @@ private:
 
             if(tr_data.type != TraceFile::ENTRY_TYPE_NOP)
             {
-                Port_MemAddr.write(addr);
-                Port_MemFunc.write(f);
-
-                if (f == Memory::FUNC_WRITE) 
+                wait_outstanding(m_max_outstanding);
+                if (m_tlm)
                 {
-                    cout << sc_time_stamp() << ": CPU sends write" << endl;
-
-                    data = rand();
-                    Port_MemData.write(data);
-                    wait();
-                    Port_MemData.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+                    transport(f, addr);
                 }
                 else
                 {
-                    cout << sc_time_stamp() << ": CPU sends read" << endl;
-                }
-
-                wait(Port_MemDone.value_changed_event());
-
-               if (f == Memory::FUNC_READ)
-                {
-                    cout << sc_time_stamp() << ": CPU reads: " << Port_MemData.read() << endl;
+                    signal_access(f, addr);
                 }
             }
             else
             {
-                cout << sc_time_stamp() << ": CPU executes NOP" << endl;
+                LOG_DEBUG(LOG_CPU, sc_time_stamp() << ": CPU executes NOP");
             }
             // Advance one cycle in simulated time            
-            wait();
+            advance(1);
+            metrics_tick(cycle());
         }
         
-        // Finished the Tracefile, now stop the simulation
+        // Finished the Tracefile, now stop the simulation once all
+        // requests have completed
+        wait_outstanding(1);
+        if (m_tlm)
+        {
+            m_qk.sync();
+        }
         sc_stop();
     }
 };
@@ -449,6 +858,8 @@ int sc_main(int argc, char* argv[])
         // Get the tracefile argument and create Tracefile object
         // This function sets tracefile_ptr and num_cpus
         init_tracefile(&argc, &argv);
+        init_options(argc, argv);
+        log_init();
 
         // Initialize statistics counters
         stats_init();
@@ -457,46 +868,82 @@ int sc_main(int argc, char* argv[])
         Memory mem("main_memory");
         CPU    cpu("cpu");
 
+        // Warm up the cache functionally, the timed simulation continues
+        // with the rest of the trace
+        long long ffwd = option_int("ffwd", 0);
+        if (ffwd > 0)
+        {
+            stats_sample warmup;
+            uint64_t done = mem.fast_forward(ffwd, warmup);
+            uint64_t hits = warmup.readhit + warmup.writehit;
+            uint64_t all  = hits + warmup.readmiss + warmup.writemiss;
+            printf("Fast-forwarded %llu entries: %llu reads (%llu hits), %llu writes (%llu hits), hitrate %f\n",
+                   (unsigned long long) done,
+                   (unsigned long long) (warmup.readhit + warmup.readmiss),
+                   (unsigned long long) warmup.readhit,
+                   (unsigned long long) (warmup.writehit + warmup.writemiss),
+                   (unsigned long long) warmup.writehit,
+                   all ? hits * 100.0 / all : 0.0);
+
+            // Nothing left to simulate in detail, report the functional run
+            if (tracefile_ptr->eof())
+            {
+                stats_merge(0, warmup);
+            }
+            else
+            {
+                // The L2/L3, memory, write-back and prefetch counters only
+                // report the detailed run, like the hits and misses
+                metrics_reset();
+            }
+        }
+
         // Signals
         sc_buffer<Memory::Function> sigMemFunc;
         sc_buffer<Memory::RetCode>  sigMemDone;
         sc_signal<int>              sigMemAddr;
         sc_signal_rv<32>            sigMemData;
-
-        // The clock that will drive the CPU and Memory
-        sc_clock clk("clk", sc_time(1, SC_NS));
+        sc_signal<int>              sigMemLatency;
 
         // Connecting module ports with signals
         mem.Port_Func(sigMemFunc);
         mem.Port_Addr(sigMemAddr);
         mem.Port_Data(sigMemData);
         mem.Port_Done(sigMemDone);
+        mem.Port_Latency(sigMemLatency);
 
         cpu.Port_MemFunc(sigMemFunc);
         cpu.Port_MemAddr(sigMemAddr);
         cpu.Port_MemData(sigMemData);
         cpu.Port_MemDone(sigMemDone);
+        cpu.Port_MemLatency(sigMemLatency);
+        cpu.socket.bind(mem.socket);
 
         sc_trace_file *wf = sc_create_vcd_trace_file("L1_Cache_Waveform");
         // Dump the desired signals
-        sc_trace(wf, clk, "clock");
         sc_trace(wf, sigMemDone, "Memory_Done");
         sc_trace(wf, sigMemAddr, "Memory_address");
 
-
-        mem.Port_CLK(clk);
-        cpu.Port_CLK(clk);
-
         cout << "Running (press CTRL+C to interrupt)... " << endl;
 
 
         // Start Simulation
         sc_start();
+        log_close();
 
 	sc_close_vcd_trace_file(wf);
         
         // Print statistics after simulation finished
         stats_print();
+        mem.hierarchy().print();
+        mem.write_buffer().print();
+        mem.mshrs().print();
+        if (mem.prefetcher() != NULL)
+        {
+            stats_sample total = stats_total();
+            mem.prefetcher()->print(total.readmiss + total.writemiss);
+        }
+        metrics_export();
     }
 
     catch (exception& e)
@@ -41,17 +41,29 @@
 #include <stdio.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
 #include "aca2009.h"
+#include "metrics.h"
 
 using namespace std;
 
-// Internal structure to keep track of statistics per CPU
+// Size of a cache line on the host
+static const size_t HOST_CACHE_LINE = 64;
+
+// Internal structure to keep track of statistics per CPU. It is padded to a
+// host cache line so that CPUs updated from different threads do not share one.
 struct stats 
 {
-    int writehit;
-    int writemiss;
-    int readhit;
-    int readmiss;
+    uint64_t writehit;
+    uint64_t writemiss;
+    uint64_t readhit;
+    uint64_t readmiss;
+    uint8_t  padding[HOST_CACHE_LINE - 4 * sizeof(uint64_t)];
 };
 
 static stats* stats_percpu  = NULL;
@@ -81,27 +93,97 @@ void init_tracefile(int* argc, char** argv[])
     }
 }
 
+// Options given on the command line, as name/value pairs
+static vector<pair<string, string> > options;
+
+void init_options(int argc, char* argv[])
+{
+    options.clear();
+    for(int i = 0; i < argc && argv[i] != NULL; i++)
+    {
+        if(strncmp(argv[i], "--", 2) != 0)
+        {
+            continue;
+        }
+
+        // Flags without a value get an empty value
+        const char* name  = argv[i] + 2;
+        const char* value = strchr(name, '=');
+        if(value == NULL)
+        {
+            options.push_back(make_pair(string(name), string()));
+        }
+        else
+        {
+            options.push_back(make_pair(string(name, value - name), string(value + 1)));
+        }
+    }
+}
+
+const char* option_string(const char* name, const char* def)
+{
+    // The last occurrence of an option wins
+    for(size_t i = options.size(); i > 0; i--)
+    {
+        if(options[i - 1].first == name)
+        {
+            return options[i - 1].second.c_str();
+        }
+    }
+    return def;
+}
+
+long long option_int(const char* name, long long def)
+{
+    const char* value = option_string(name, NULL);
+    if(value == NULL)
+    {
+        return def;
+    }
+
+    char* end;
+    long long result = strtoll(value, &end, 0);
+    if(*value == '\0' || *end != '\0')
+    {
+        throw runtime_error(string("Error, option --") + name + " expects a number");
+    }
+    return result;
+}
+
+bool option_flag(const char* name)
+{
+    return option_string(name, NULL) != NULL;
+}
+
 // Allocates and sets up stats datastructure
 void stats_init()
 {
-    stats_percpu = (stats*) malloc(sizeof(stats) * num_cpus);
-    if(stats_percpu == NULL)
+    void* mem = NULL;
+    if(posix_memalign(&mem, HOST_CACHE_LINE, sizeof(stats) * num_cpus) != 0)
     {
         throw runtime_error(string("Error, unable to allocate statistics memory"));
     }
-    
+    stats_percpu = (stats*) mem;
+    memset(stats_percpu, 0, sizeof(stats) * num_cpus);
+
     for(unsigned int i = 0; i < num_cpus; i++)
     {
-        stats_percpu[i].writehit = 0;
-        stats_percpu[i].writemiss = 0;
-        stats_percpu[i].readhit = 0;
-        stats_percpu[i].readmiss = 0;
+        char name[32];
+        sprintf(name, "cpu%u.readhit", i);
+        metrics_register(name, &stats_percpu[i].readhit, "Read hits");
+        sprintf(name, "cpu%u.readmiss", i);
+        metrics_register(name, &stats_percpu[i].readmiss, "Read misses");
+        sprintf(name, "cpu%u.writehit", i);
+        metrics_register(name, &stats_percpu[i].writehit, "Write hits");
+        sprintf(name, "cpu%u.writemiss", i);
+        metrics_register(name, &stats_percpu[i].writemiss, "Write misses");
     }
 }
 
 void stats_cleanup()
 {
     free(stats_percpu);
+    stats_percpu = NULL;
 }
 
 void stats_print()
@@ -110,178 +192,843 @@ void stats_print()
     {
         throw runtime_error(string("Error, unable to open statistics. Did you run stats_init()?"));
     }
+
+    vector<stats_sample> samples(num_cpus);
+    stats_snapshot(samples.empty() ? NULL : &samples[0]);
+
     printf("CPU\tReads\tRHit\tRMiss\tWrites\tWHit\tWMiss\tHitrate\n");
     for(unsigned int i =0; i < num_cpus; i++)
     {
-        int writes = stats_percpu[i].writehit + stats_percpu[i].writemiss;
-        int reads = stats_percpu[i].readhit + stats_percpu[i].readmiss;
+        const stats_sample& s = samples[i];
+        uint64_t writes = s.writehit + s.writemiss;
+        uint64_t reads = s.readhit + s.readmiss;
 
         // Ratio of hits to the number of total accesses
-        double hitrate = (stats_percpu[i].writehit + stats_percpu[i].readhit) /
-        (double) (writes + reads);
+        double hitrate = (s.writehit + s.readhit) / (double) (writes + reads);
                   
         // To make it a percentage
         hitrate = hitrate * 100;
          
-        printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%f\n", i,
-               reads, stats_percpu[i].readhit, stats_percpu[i].readmiss, 
-               writes, stats_percpu[i].writehit, stats_percpu[i].writemiss, 
+        printf("%d\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%f\n", i,
+               (unsigned long long) reads, (unsigned long long) s.readhit,
+               (unsigned long long) s.readmiss, (unsigned long long) writes,
+               (unsigned long long) s.writehit, (unsigned long long) s.writemiss,
                hitrate);
     }
 }
 
+// Counters are updated atomically; no ordering with other memory is needed
+static inline void stats_add(uint64_t& counter, uint64_t value)
+{
+    __atomic_fetch_add(&counter, value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stats_load(const uint64_t& counter)
+{
+    return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
 void stats_writehit(uint32_t cpuid)
 {
     if(cpuid < num_cpus && stats_percpu != NULL)
     {
-        stats_percpu[cpuid].writehit++;
+        stats_add(stats_percpu[cpuid].writehit, 1);
     }
+    metrics_access();
 }
 
 void stats_writemiss(uint32_t cpuid)
 {
     if(cpuid < num_cpus && stats_percpu != NULL)
     {
-        stats_percpu[cpuid].writemiss++;
+        stats_add(stats_percpu[cpuid].writemiss, 1);
     }
+    metrics_access();
 }
 
 void stats_readhit(uint32_t cpuid)
 {
     if(cpuid < num_cpus && stats_percpu != NULL)
     {
-        stats_percpu[cpuid].readhit++;
+        stats_add(stats_percpu[cpuid].readhit, 1);
     }
+    metrics_access();
 }
 
 void stats_readmiss(uint32_t cpuid)
 {
     if(cpuid < num_cpus && stats_percpu != NULL)
     {
-        stats_percpu[cpuid].readmiss++;
+        stats_add(stats_percpu[cpuid].readmiss, 1);
+    }
+    metrics_access();
+}
+
+void stats_snapshot(stats_sample* samples)
+{
+    for(unsigned int i = 0; i < num_cpus && stats_percpu != NULL; i++)
+    {
+        samples[i].writehit  = stats_load(stats_percpu[i].writehit);
+        samples[i].writemiss = stats_load(stats_percpu[i].writemiss);
+        samples[i].readhit   = stats_load(stats_percpu[i].readhit);
+        samples[i].readmiss  = stats_load(stats_percpu[i].readmiss);
+    }
+}
+
+void stats_merge(uint32_t cpuid, const stats_sample& delta)
+{
+    if(cpuid < num_cpus && stats_percpu != NULL)
+    {
+        stats_add(stats_percpu[cpuid].writehit,  delta.writehit);
+        stats_add(stats_percpu[cpuid].writemiss, delta.writemiss);
+        stats_add(stats_percpu[cpuid].readhit,   delta.readhit);
+        stats_add(stats_percpu[cpuid].readmiss,  delta.readmiss);
+    }
+    metrics_access(delta.writehit + delta.writemiss + delta.readhit + delta.readmiss);
+}
+
+stats_sample stats_total()
+{
+    stats_sample total;
+    memset(&total, 0, sizeof(total));
+
+    vector<stats_sample> samples(num_cpus);
+    stats_snapshot(samples.empty() ? NULL : &samples[0]);
+    for(unsigned int i = 0; i < num_cpus; i++)
+    {
+        total.writehit  += samples[i].writehit;
+        total.writemiss += samples[i].writemiss;
+        total.readhit   += samples[i].readhit;
+        total.readmiss  += samples[i].readmiss;
     }
+    return total;
+}
+
+const size_t TraceFile::V3_HEADER_SIZE;
+const size_t TraceFile::V3_DIRECTORY_SIZE;
+const size_t TraceFile::V3_CHUNK_ENTRY_SIZE;
+const size_t TraceFile::BATCH_SIZE;
+
+// Reads big-endian integers from the mapped tracefile
+static uint32_t read_be32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohl(value);
+}
+
+static uint64_t read_be64(const uint8_t* p)
+{
+    return ((uint64_t) read_be32(p) << 32) | read_be32(p + 4);
 }
 
 TraceFile::TraceFile(const char* filename)
-    : m_input(filename, ios::in | ios::binary)
+    : m_format(FORMAT_V2), m_base(NULL), m_size(0), m_chunk_entries(0),
+      m_stream(NULL), m_num_finished(0)
 {
     // Check if the file properly opened
-    if (!m_input.is_open() || !m_input.good())
+    int fd = strcmp(filename, "-") ? open(filename, O_RDONLY) : dup(0);
+    if (fd < 0)
     {
         throw runtime_error(string("Unable to open file: ") + filename);
     }
 
-    // Check file signature
-    char signature[4];
-    m_input.read( (char*)&signature, 4);
-    if (m_input.fail() || strncmp(signature, "2TRF", 4))
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        throw runtime_error(string("Unable to open file: ") + filename);
+    }
+
+    // Pipes and compressed files are read as a stream instead of mapped
+    unsigned char magic[2];
+    if (!S_ISREG(st.st_mode) ||
+        (pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1F && magic[1] == 0x8B))
     {
+        open_stream(fd, filename);
+        return;
+    }
+
+    // A file without room for the signature and processor count is invalid
+    if (st.st_size < 8)
+    {
+        ::close(fd);
         throw runtime_error(string("Invalid file signature in file: ") + filename);
     }
 
-    // Read number of processors the file was created for
-    uint32_t procs_count;
-    m_input.read( (char*)&procs_count, sizeof(uint32_t));
-    if (m_input.fail())
+    // Map the whole file once; the descriptor is not needed afterwards
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
     {
-        throw runtime_error("Unable to read file");
+        throw runtime_error(string("Unable to map file: ") + filename);
     }
-    
-    // Transform result into host-order
-    procs_count = ntohl(procs_count);
+    m_base = (const uint8_t*) map;
+    m_size = st.st_size;
 
-    // Set the start positions of the processor traces
-    m_positions.resize( procs_count );
-    streampos start = m_input.tellg();
+    // Every CPU walks the file front to back, let the kernel read ahead
+    madvise(map, m_size, MADV_SEQUENTIAL);
+
+    // Check file signature
+    if (!strncmp((const char*) m_base, "3TRF", 4))
+    {
+        open_v3(filename);
+        return;
+    }
+    if (strncmp((const char*) m_base, "2TRF", 4))
+    {
+        close();
+        throw runtime_error(string("Invalid file signature in file: ") + filename);
+    }
 
-    // And in the meanwhile store the end position of the file
-    m_input.seekg(0, ios::end);
-    m_endstream = m_input.tellg();
+    // Read number of processors the file was created for and transform the
+    // result into host-order
+    uint32_t procs_count = read_be32(m_base + 4);
 
-    if((start + (streamoff)((procs_count * 4) + 3)) >= m_endstream)
+    // Set the start positions of the processor traces
+    size_t start = 8;
+    if (start + (size_t) procs_count * 4 + 3 >= m_size)
     {
+        close();
         throw runtime_error(string("Unexpected end of tracefile: ") + filename);
     }
-    
+
+    m_streams.resize( procs_count );
     for(uint32_t i = 0; i < procs_count; i++)
     {
-        m_positions[i] = start + (streamoff)(i*4);
+        CpuStream& s = m_streams[i];
+        s.head     = 0;
+        s.position = start + i * 4;
+        s.last     = false;
+        s.finished = false;
+        s.entries.reserve(BATCH_SIZE);
     }
+    m_raw.resize(BATCH_SIZE);
 }
 
-TraceFile::~TraceFile()
+void TraceFile::open_v3(const char* filename)
 {
+    m_format = FORMAT_V3;
+    if (m_size < V3_HEADER_SIZE)
+    {
+        close();
+        throw runtime_error(string("Unexpected end of tracefile: ") + filename);
+    }
+
+    uint32_t procs_count = read_be32(m_base + 4);
+    m_chunk_entries      = read_be32(m_base + 8);
+    if (m_chunk_entries == 0 ||
+        V3_HEADER_SIZE + (uint64_t) procs_count * V3_DIRECTORY_SIZE > m_size)
+    {
+        close();
+        throw runtime_error(string("Invalid header in tracefile: ") + filename);
+    }
+
+    m_streams.resize( procs_count );
+    for(uint32_t i = 0; i < procs_count; i++)
+    {
+        const uint8_t* dir = m_base + V3_HEADER_SIZE + i * V3_DIRECTORY_SIZE;
+
+        CpuStream& s  = m_streams[i];
+        s.head        = 0;
+        s.position    = 0;
+        s.finished    = false;
+        s.entry_count = read_be64(dir);
+        s.chunk_count = read_be32(dir + 16);
+
+        // Check that the chunk table and all chunks lie within the file
+        uint64_t table = read_be64(dir + 8);
+        if (table + (uint64_t) s.chunk_count * V3_CHUNK_ENTRY_SIZE > m_size ||
+            s.entry_count > (uint64_t) s.chunk_count * m_chunk_entries)
+        {
+            close();
+            throw runtime_error(string("Invalid directory in tracefile: ") + filename);
+        }
+        s.chunk_table = m_base + table;
+
+        for (uint32_t c = 0; c < s.chunk_count; c++)
+        {
+            const uint8_t* chunk = s.chunk_table + c * V3_CHUNK_ENTRY_SIZE;
+            if (read_be64(chunk) + read_be32(chunk + 8) > m_size)
+            {
+                close();
+                throw runtime_error(string("Invalid chunk table in tracefile: ") + filename);
+            }
+        }
+
+        s.last = (s.entry_count == 0);
+        s.entries.reserve(m_chunk_entries);
+    }
+
+    // A processor without entries has ended right away
+    for(uint32_t i = 0; i < procs_count; i++)
+    {
+        check_finished(m_streams[i]);
+    }
 }
 
-void TraceFile::close()
+// Size of each of the two buffers the decompression thread fills
+static const size_t STREAM_BLOCK_SIZE = 1 << 20;
+
+struct TraceFile::StreamState
+{
+    gzFile          file;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    vector<uint8_t> data[2];
+    int             size[2];        // Bytes in the buffer, -1 = empty,
+                                    // 0 = end of stream, -2 = error
+    string          error;          // Error message of the thread
+    bool            stop;           // Tells the thread to stop
+
+    // Only accessed by the reading side
+    unsigned        current;        // Buffer to read next
+    uint32_t        column;         // Processor of the next word
+    uint8_t         carry[4];       // Bytes of a word split over two blocks
+    size_t          carry_size;
+    bool            done;           // End of the stream was reached
+};
+
+void TraceFile::open_stream(int fd, const char* filename)
 {
-    m_input.close();
-    m_positions.resize(0);
+    m_format = FORMAT_STREAM;
+
+    // Reads compressed as well as uncompressed data, and takes over fd
+    gzFile file = gzdopen(fd, "rb");
+    if (file == NULL)
+    {
+        ::close(fd);
+        throw runtime_error(string("Unable to open file: ") + filename);
+    }
+    gzbuffer(file, 256 * 1024);
+
+    // Check file signature and read the number of processors
+    uint8_t header[8];
+    if (gzread(file, header, sizeof(header)) != (int) sizeof(header) ||
+        strncmp((const char*) header, "2TRF", 4))
+    {
+        if (!strncmp((const char*) header, "3TRF", 4))
+        {
+            // The chunk tables of this format need random access
+            gzclose(file);
+            throw runtime_error(string("3TRF files cannot be streamed: ") + filename);
+        }
+        gzclose(file);
+        throw runtime_error(string("Invalid file signature in file: ") + filename);
+    }
+    uint32_t procs_count = read_be32(header + 4);
+    if (procs_count == 0)
+    {
+        gzclose(file);
+        throw runtime_error(string("Unexpected end of tracefile: ") + filename);
+    }
+
+    m_streams.resize( procs_count );
+    for(uint32_t i = 0; i < procs_count; i++)
+    {
+        CpuStream& s = m_streams[i];
+        s.head     = 0;
+        s.position = 0;
+        s.last     = false;
+        s.finished = false;
+    }
+
+    m_stream = new StreamState;
+    m_stream->file       = file;
+    m_stream->stop       = false;
+    m_stream->current    = 0;
+    m_stream->column     = 0;
+    m_stream->carry_size = 0;
+    m_stream->done       = false;
+    for (int i = 0; i < 2; i++)
+    {
+        m_stream->data[i].resize(STREAM_BLOCK_SIZE);
+        m_stream->size[i] = -1;
+    }
+    pthread_mutex_init(&m_stream->lock, NULL);
+    pthread_cond_init(&m_stream->cond, NULL);
+
+    if (pthread_create(&m_stream->thread, NULL, stream_main, m_stream) != 0)
+    {
+        pthread_mutex_destroy(&m_stream->lock);
+        pthread_cond_destroy(&m_stream->cond);
+        gzclose(file);
+        delete m_stream;
+        m_stream = NULL;
+        throw runtime_error("Unable to start decompression thread");
+    }
 }
 
-uint32_t TraceFile::get_proc_count() const 
+void* TraceFile::stream_main(void* arg)
 {
-    return m_positions.size();
+    StreamState* st = (StreamState*) arg;
+
+    // Fill both buffers in turn, until the end of the stream
+    for (unsigned i = 0; ; i ^= 1)
+    {
+        pthread_mutex_lock(&st->lock);
+        while (st->size[i] != -1 && !st->stop)
+        {
+            pthread_cond_wait(&st->cond, &st->lock);
+        }
+        pthread_mutex_unlock(&st->lock);
+        if (st->stop)
+        {
+            break;
+        }
+
+        int size = gzread(st->file, &st->data[i][0], STREAM_BLOCK_SIZE);
+
+        pthread_mutex_lock(&st->lock);
+        if (size < 0)
+        {
+            int errnum;
+            st->error = gzerror(st->file, &errnum);
+            size = -2;
+        }
+        st->size[i] = size;
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->lock);
+
+        if (size <= 0)
+        {
+            break;
+        }
+    }
+    return NULL;
 }
 
-bool TraceFile::next(uint32_t pid, Entry& e)
+bool TraceFile::read_stream_block()
 {
-    uint32_t cpucount = get_proc_count();
-    
-    if (pid >= cpucount) 
+    StreamState* st = m_stream;
+    if (st->done)
     {
-        // Invalid processor ID
         return false;
     }
 
-    uint32_t data;
+    // Wait for the decompression thread to fill the next buffer
+    unsigned i = st->current;
+    pthread_mutex_lock(&st->lock);
+    while (st->size[i] == -1)
+    {
+        pthread_cond_wait(&st->cond, &st->lock);
+    }
+    int size = st->size[i];
+    pthread_mutex_unlock(&st->lock);
+
+    if (size == -2)
+    {
+        throw runtime_error("Unable to decompress tracefile: " + st->error);
+    }
+
+    if (size == 0)
+    {
+        // We can no longer read a whole entry, so all traces end here
+        st->done = true;
+        for (size_t p = 0; p < m_streams.size(); p++)
+        {
+            m_streams[p].last = true;
+            check_finished(m_streams[p]);
+        }
+        return false;
+    }
+
+    // Drop the entries that were already read from the processor buffers
+    for (size_t p = 0; p < m_streams.size(); p++)
+    {
+        CpuStream& s = m_streams[p];
+        if (s.head == s.entries.size())
+        {
+            s.entries.clear();
+            s.head = 0;
+        }
+        else if (s.head >= BATCH_SIZE)
+        {
+            s.entries.erase(s.entries.begin(), s.entries.begin() + s.head);
+            s.head = 0;
+        }
+    }
 
-    // Test if there is a valid position in the trace registered for this CPU
-    if(m_positions[pid] != (streampos) 0)
-    {    
-        m_input.seekg(m_positions[pid]);
-        m_input.read((char*) &data, sizeof(data));
+    // Complete a word which was split over the previous block
+    const uint8_t* src = &st->data[i][0];
+    size_t         len = size;
+    uint32_t       words[2];
+    size_t         count = 0;
+    if (st->carry_size > 0)
+    {
+        size_t n = min(len, 4 - st->carry_size);
+        memcpy(st->carry + st->carry_size, src, n);
+        st->carry_size += n;
+        src += n;
+        len -= n;
+        if (st->carry_size == 4)
+        {
+            memcpy(&words[0], st->carry, 4);
+            count = 1;
+            st->carry_size = 0;
+        }
+    }
 
-        // Transform data into correct order
+    // De-interleave the words of this block into the processor buffers
+    uint32_t cpucount = get_proc_count();
+    size_t   total    = count + len / 4;
+    for (size_t w = 0; w < total; w++)
+    {
+        uint32_t data;
+        if (w < count)
+        {
+            data = words[w];
+        }
+        else
+        {
+            memcpy(&data, src + (w - count) * 4, 4);
+        }
         data = ntohl(data);
 
-        // Seek to next value
-        m_positions[pid] += cpucount * sizeof(data);
+        CpuStream& s = m_streams[st->column];
+        if (++st->column == cpucount)
+        {
+            st->column = 0;
+        }
+
+        if (s.last)
+        {
+            // Words after the end tag of a trace are ignored
+            continue;
+        }
 
-        // Separate Address and Type-Tag information
+        Entry e;
         e.addr = data & ~0x3UL;
         e.type = (EntryType) (data & 0x3);
-        
-        // Check if we encountered an end tag
-        if(e.type == ENTRY_TYPE_END)
+        if (e.type == ENTRY_TYPE_END)
         {
-            // We send a NOP instead
+            // We send a NOP instead and stop reading this trace
             e.type = ENTRY_TYPE_NOP;
-
-            // And register that this cpu's trace has ended
-            m_positions[pid] = 0;
-            m_num_finished++;
+            s.last = true;
         }
-        else if(m_positions[pid] > (m_endstream - (streampos)sizeof(data)))
+        s.entries.push_back(e);
+    }
+
+    // Keep the bytes of an incomplete word for the next block
+    size_t rest = len % 4;
+    memcpy(st->carry + st->carry_size, src + len - rest, rest);
+    st->carry_size += rest;
+
+    // Hand the buffer back to the decompression thread
+    pthread_mutex_lock(&st->lock);
+    st->size[i] = -1;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->lock);
+    st->current ^= 1;
+    return true;
+}
+
+void TraceFile::refill_stream(CpuStream& s)
+{
+    while (s.entries.empty() && !s.last)
+    {
+        if (!read_stream_block())
         {
-            // We didnt encounter an end tag but we can no longer read a whole
-            // entry from the file, so we stop reading this trace from now on
-            m_positions[pid] = 0;
-            m_num_finished++;
+            break;
         }
     }
+}
+
+TraceFile::~TraceFile()
+{
+    close();
+}
+
+void TraceFile::close()
+{
+    if (m_stream != NULL)
+    {
+        pthread_mutex_lock(&m_stream->lock);
+        m_stream->stop = true;
+        pthread_cond_broadcast(&m_stream->cond);
+        pthread_mutex_unlock(&m_stream->lock);
+        pthread_join(m_stream->thread, NULL);
+
+        pthread_mutex_destroy(&m_stream->lock);
+        pthread_cond_destroy(&m_stream->cond);
+        gzclose(m_stream->file);
+        delete m_stream;
+        m_stream = NULL;
+    }
+
+    if (m_base != NULL)
+    {
+        munmap((void*) m_base, m_size);
+        m_base = NULL;
+        m_size = 0;
+    }
+    m_streams.resize(0);
+}
+
+uint32_t TraceFile::get_proc_count() const 
+{
+    return m_streams.size();
+}
+
+void TraceFile::check_finished(CpuStream& s)
+{
+    if (s.last && !s.finished && s.head == s.entries.size())
+    {
+        s.finished = true;
+        m_num_finished++;
+    }
+}
+
+void TraceFile::refill(uint32_t pid)
+{
+    CpuStream& s = m_streams[pid];
+    s.entries.clear();
+    s.head = 0;
+
+    // Test if there are entries left in the trace of this CPU
+    if (s.last)
+    {
+        return;
+    }
+
+    if (m_format == FORMAT_STREAM)
+    {
+        refill_stream(s);
+    }
+    else if (m_format == FORMAT_V3)
+    {
+        refill_v3(s);
+    }
+    else
+    {
+        refill_v2(s);
+    }
+}
+
+void TraceFile::refill_v2(CpuStream& s)
+{
+    // The entries of the processors are interleaved in the file, so the
+    // entries of one processor are cpucount words apart
+    size_t stride = get_proc_count() * sizeof(uint32_t);
+    size_t avail  = (m_size - sizeof(uint32_t) - s.position) / stride + 1;
+    size_t count  = (avail < BATCH_SIZE) ? avail : BATCH_SIZE;
+
+    // Gather the words of this processor and transform them into host order
+    const uint8_t* src = m_base + s.position;
+    uint32_t*      raw = &m_raw[0];
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(&raw[i], src + i * stride, sizeof(uint32_t));
+        raw[i] = ntohl(raw[i]);
+    }
+
+    // Find out if we encountered an end tag in this batch
+    size_t n = 0;
+    while (n < count && (raw[n] & 0x3) != ENTRY_TYPE_END)
+    {
+        n++;
+    }
+
+    // Separate Address and Type-Tag information
+    s.entries.resize(n);
+    Entry* out = s.entries.data();
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i].addr = raw[i] & ~0x3UL;
+        out[i].type = (EntryType) (raw[i] & 0x3);
+    }
+
+    if (n < count)
+    {
+        // We send a NOP instead of the end tag and stop reading this trace
+        Entry e;
+        e.addr = raw[n] & ~0x3UL;
+        e.type = ENTRY_TYPE_NOP;
+        s.entries.push_back(e);
+        s.last = true;
+    }
+    else if (count == avail)
+    {
+        // We didnt encounter an end tag but we can no longer read a whole
+        // entry from the file, so we stop reading this trace from now on
+        s.last = true;
+    }
+    else
+    {
+        s.position += count * stride;
+    }
+}
+
+void TraceFile::refill_v3(CpuStream& s)
+{
+    const uint8_t* chunk = s.chunk_table + s.position * V3_CHUNK_ENTRY_SIZE;
+    const uint8_t* p     = m_base + read_be64(chunk);
+    const uint8_t* end   = p + read_be32(chunk + 8);
+
+    // Every chunk is full, except for the last chunk of a trace
+    uint64_t first = (uint64_t) s.position * m_chunk_entries;
+    uint64_t left  = s.entry_count - first;
+    size_t   count = (left < m_chunk_entries) ? left : m_chunk_entries;
+
+    s.entries.resize(count);
+    Entry*   out  = s.entries.data();
+    uint32_t prev = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t value = 0;
+        unsigned shift = 0;
+        uint8_t  byte;
+        do
+        {
+            if (p == end || shift > 63)
+            {
+                throw runtime_error("Corrupt chunk in tracefile");
+            }
+            byte   = *p++;
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        // Undo the zigzag encoding of the word address delta
+        uint32_t zigzag = (uint32_t) (value >> 2);
+        prev += (zigzag >> 1) ^ (0U - (zigzag & 1));
+
+        out[i].addr = prev << 2;
+        out[i].type = (EntryType) (value & 0x3);
+    }
+
+    s.position++;
+    if (s.position == s.chunk_count || first + count == s.entry_count)
+    {
+        s.last = true;
+    }
+}
+
+bool TraceFile::next(uint32_t pid, Entry& e)
+{
+    if (pid >= get_proc_count()) 
+    {
+        // Invalid processor ID
+        return false;
+    }
+
+    CpuStream& s = m_streams[pid];
+    if (s.head == s.entries.size())
+    {
+        refill(pid);
+    }
+
+    if (s.head < s.entries.size())
+    {
+        e = s.entries[s.head++];
+
+        // Register that this cpu's trace has ended with its last entry
+        check_finished(s);
+    }
     else
     {
         // This trace already ended so we only send a NOP
         e.addr = 0;
         e.type = ENTRY_TYPE_NOP; 
+        check_finished(s);
     }    
 
     return true;
 }
 
+size_t TraceFile::next_batch(uint32_t pid, Entry* out, size_t n)
+{
+    if (pid >= get_proc_count()) 
+    {
+        // Invalid processor ID
+        return 0;
+    }
+
+    CpuStream& s = m_streams[pid];
+    size_t done = 0;
+    while (done < n)
+    {
+        if (s.head == s.entries.size())
+        {
+            refill(pid);
+            if (s.entries.empty())
+            {
+                check_finished(s);
+                break;
+            }
+        }
+
+        size_t count = s.entries.size() - s.head;
+        if (count > n - done)
+        {
+            count = n - done;
+        }
+        memcpy(out + done, &s.entries[s.head], count * sizeof(Entry));
+        s.head += count;
+        done   += count;
+
+        check_finished(s);
+    }
+    return done;
+}
+
+bool TraceFile::seek(uint32_t pid, uint64_t index)
+{
+    if (pid >= get_proc_count()) 
+    {
+        // Invalid processor ID
+        return false;
+    }
+
+    if (m_format == FORMAT_STREAM)
+    {
+        throw runtime_error("Unable to seek in a streamed tracefile");
+    }
+
+    CpuStream& s = m_streams[pid];
+    if (s.finished)
+    {
+        // The trace is read again, so it has not ended anymore
+        s.finished = false;
+        m_num_finished--;
+    }
+    s.entries.clear();
+    s.head = 0;
+    s.last = false;
+
+    bool found;
+    if (m_format == FORMAT_V3)
+    {
+        // Decode the chunk holding the entry and skip to it
+        found = (index < s.entry_count);
+        if (found)
+        {
+            s.position = index / m_chunk_entries;
+            refill_v3(s);
+            s.head = index % m_chunk_entries;
+        }
+    }
+    else
+    {
+        uint64_t position = 8 + (index * get_proc_count() + pid) * sizeof(uint32_t);
+        found = (position <= m_size - sizeof(uint32_t));
+        if (found)
+        {
+            s.position = position;
+        }
+    }
+
+    if (!found)
+    {
+        s.last = true;
+        check_finished(s);
+    }
+    return found;
+}
+
 bool TraceFile::eof() const
 {
-    return (m_num_finished == m_positions.size());
+    return (m_num_finished == m_streams.size());
 }
 
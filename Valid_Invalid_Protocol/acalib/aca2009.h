@@ -65,24 +65,97 @@ typedef unsigned __int64    uint64_t;
  */
 void init_tracefile(int* argc, char** argv[]);
 
+/*
+ * Reads the options of the form --name=value, or --name for a flag, from the
+ * arguments left after init_tracefile. Other arguments are ignored. The
+ * options can then be read anywhere with the option_* functions.
+ */
+void init_options(int argc, char* argv[]);
+
+// Returns the value of an option, or def if the option was not given
+const char* option_string(const char* name, const char* def);
+long long   option_int(const char* name, long long def);
+
+// Returns whether an option was given
+bool option_flag(const char* name);
+
 /*
  * Initializes the statistic counters, needs to be run after init_tracefile
- * as it uses num_cpus to generate its datastructures.
+ * as it uses num_cpus to generate its datastructures. The counters are also
+ * registered as metrics "cpu<N>.readhit" etc, see metrics.h.
  */
 void stats_init();
 
-// Removes and cleanes up the internal statistic counters
+// Removes and cleanes up the internal statistic counters, write the metrics
+// (see metrics.h) before calling this
 void stats_cleanup();
 
 // Pretty-prints the contents of the statistic counters
 void stats_print();
 
-// Updates the internal statistic counters for given CPU
+/*
+ * Updates the internal statistic counters for given CPU. The counters are
+ * 64 bit and each CPU has its own cache line, so these functions can be
+ * called from several host threads at the same time. They also count the
+ * access for --sample-accesses, but the samples are only taken by
+ * metrics_tick() (see metrics.h).
+ */
 void stats_writehit(uint32_t cpuid);
 void stats_writemiss(uint32_t cpuid);
 void stats_readhit(uint32_t cpuid);
 void stats_readmiss(uint32_t cpuid);
 
+// Copy of the statistic counters of one CPU
+struct stats_sample
+{
+    uint64_t writehit;
+    uint64_t writemiss;
+    uint64_t readhit;
+    uint64_t readmiss;
+};
+
+// Copies the current counters of all CPUs into samples[0..num_cpus-1]
+void stats_snapshot(stats_sample* samples);
+
+/*
+ * Adds the counts in delta to the counters of given CPU at once, and counts
+ * them for --sample-accesses. A thread can count accesses in a private
+ * stats_sample and merge it every so often, instead of updating the shared
+ * counters on every access.
+ */
+void stats_merge(uint32_t cpuid, const stats_sample& delta);
+
+// Returns the sum of the counters of all CPUs
+stats_sample stats_total();
+
+/*
+ * Two tracefile formats are supported, both storing all integers in network
+ * byte order:
+ *
+ * "2TRF": a 4 byte signature and the processor count, followed by one 32 bit
+ *         word per entry (address | type) with the entries of all processors
+ *         interleaved round-robin. A trace ends with an END tag.
+ *
+ * "3TRF": a 16 byte header (signature, processor count, entries per chunk,
+ *         reserved), followed by a 24 byte directory entry per processor
+ *         (entry count: 64 bit, chunk table offset: 64 bit, chunk count:
+ *         32 bit, reserved). The entries of each processor are stored in
+ *         chunks of a fixed number of entries. Every entry is a LEB128 varint
+ *         of (zigzag(word address delta) << 2 | type), where the delta is
+ *         taken to the previous entry of the same chunk, so that every chunk
+ *         decodes on its own. A chunk table holds a 12 byte entry per chunk
+ *         (file offset: 64 bit, length in bytes: 32 bit). The end of a trace
+ *         is given by the entry count instead of an END tag. Use the trfconv
+ *         tool to convert a "2TRF" file.
+ *
+ * A "2TRF" file can also be read as a stream: gzip compressed files, pipes
+ * and standard input (filename "-") are decompressed by a separate thread
+ * and de-interleaved into the per-processor buffers as the simulation runs.
+ * Other compressors can be used through a pipe, e.g.
+ * "zstd -dc trace.trf.zst | simulator -". Streams cannot be seeked, and the
+ * entries of a processor which is read less often than the others are
+ * buffered in memory until they are read.
+ */
 class TraceFile 
 {
 public:
@@ -102,11 +175,20 @@ public:
         uint32_t      addr;
     };
 
-    // Constructor / Destructor
+    // Sizes of the fixed parts of a "3TRF" file
+    static const size_t V3_HEADER_SIZE      = 16;
+    static const size_t V3_DIRECTORY_SIZE   = 24;
+    static const size_t V3_CHUNK_ENTRY_SIZE = 12;
+
+    /*
+     * Constructor / Destructor. The file is mapped into memory once and all
+     * entries are decoded directly from the mapping, so reading a trace does
+     * not cost a system call per entry.
+     */
     TraceFile(const char* filename);
     ~TraceFile();
 
-    // Closes the file
+    // Closes the file and releases the mapping
     void close();
 
     /*
@@ -116,6 +198,24 @@ public:
      */
     bool next(uint32_t pid, Entry& e);
 
+    /*
+     * Reads up to n entries for the processor specified in pid into out.
+     * Returns the number of entries read, which is less than n once the
+     * trace of that processor has ended. Unlike next(), no NOPs are returned
+     * after the end of the trace.
+     */
+    size_t next_batch(uint32_t pid, Entry* out, size_t n);
+
+    /*
+     * Positions the trace of the processor specified in pid at the entry
+     * with the given index, so that a replay can start in the middle of a
+     * trace. On "3TRF" files only the chunk holding the entry is decoded.
+     * On "2TRF" files the position is computed directly, an END tag before
+     * the entry is not detected. Returns false if the index lies beyond the
+     * end of the trace, in which case the trace is marked as ended.
+     */
+    bool seek(uint32_t pid, uint64_t index);
+
     // Determines if the end-of-file has been reached
     bool eof() const;
 
@@ -123,12 +223,64 @@ public:
     uint32_t get_proc_count() const;
 
 private:
-    struct EntryInfo;
+    // Number of entries decoded per processor in one pass over the file
+    static const size_t BATCH_SIZE = 4096;
+
+    enum Format
+    {
+        FORMAT_V2,      // "2TRF"
+        FORMAT_V3,      // "3TRF"
+        FORMAT_STREAM   // "2TRF" read through a decompressing stream
+    };
+
+    // State of the decompression thread of a streamed tracefile
+    struct StreamState;
+
+    // Per-processor buffer of entries which are decoded but not yet read
+    struct CpuStream
+    {
+        std::vector<Entry> entries;
+        size_t             head;        // Index of next entry to hand out
+        size_t             position;    // V2: offset of next entry
+                                        // V3: index of next chunk
+        bool               last;        // entries holds the end of the trace
+        bool               finished;    // The end of the trace was read
+
+        // "3TRF" only
+        uint64_t           entry_count;
+        const uint8_t*     chunk_table;
+        uint32_t           chunk_count;
+    };
+
+    // Parses the header of a "3TRF" file
+    void open_v3(const char* filename);
+
+    // Starts reading the file given by fd as a stream
+    void open_stream(int fd, const char* filename);
+
+    // Decodes the next batch of entries for the processor specified in pid
+    void refill(uint32_t pid);
+    void refill_v2(CpuStream& s);
+    void refill_v3(CpuStream& s);
+    void refill_stream(CpuStream& s);
+
+    // De-interleaves the next block of a stream into all processor buffers
+    bool read_stream_block();
+
+    // Main function of the decompression thread
+    static void* stream_main(void* arg);
+
+    // Marks the trace of a processor as ended once its last entry is read
+    void check_finished(CpuStream& s);
 
-    std::ifstream               m_input;
-    std::vector<std::streampos> m_positions;
+    Format                      m_format;
+    const uint8_t*              m_base;         // Start of the mapped file
+    size_t                      m_size;         // Size of the mapping in bytes
+    uint32_t                    m_chunk_entries;
+    StreamState*                m_stream;
+    std::vector<CpuStream>      m_streams;
+    std::vector<uint32_t>       m_raw;          // Scratch space for refill()
     uint32_t                    m_num_finished;
-    std::streampos              m_endstream;
 
     // Private copy constructor because no copies are allowed.
     TraceFile(const TraceFile& trf);
@@ -0,0 +1,234 @@
+/*
+// File: acalog.cpp
+//
+// Tracing of simulator events by level and category, see acalog.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "acalog.h"
+#include "aca2009.h"
+
+using namespace std;
+
+// Bytes collected before the log thread is woken up, and at which callers
+// wait for the log thread to catch up
+static const size_t LOG_BATCH_SIZE   = 64 * 1024;
+static const size_t LOG_MAX_PENDING  = 16 * 1024 * 1024;
+
+static const char* const LEVEL_NAMES[] =
+{
+    "none", "error", "warn", "info", "debug", "trace"
+};
+
+static const char* const CATEGORY_NAMES[LOG_CATEGORY_COUNT] =
+{
+    "cpu", "cache", "bus", "coherence"
+};
+
+unsigned char log_levels[LOG_CATEGORY_COUNT] =
+{
+    LOG_LEVEL_INFO, LOG_LEVEL_INFO, LOG_LEVEL_INFO, LOG_LEVEL_INFO
+};
+
+static FILE*           log_file     = NULL;
+static bool            log_threaded = false;
+static bool            log_stop     = false;
+static pthread_t       log_thread;
+static pthread_mutex_t log_lock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  log_cond     = PTHREAD_COND_INITIALIZER;
+static vector<char>    log_pending;
+
+static int parse_level(const char* name, size_t len)
+{
+    for (int i = LOG_LEVEL_NONE; i <= LOG_LEVEL_TRACE; i++)
+    {
+        if (strlen(LEVEL_NAMES[i]) == len && !strncmp(LEVEL_NAMES[i], name, len))
+        {
+            return i;
+        }
+    }
+    if (len == 1 && name[0] >= '0' && name[0] <= '5')
+    {
+        return name[0] - '0';
+    }
+    throw runtime_error(string("Error, unknown log level: ") + string(name, len));
+}
+
+// Parses the --log option, a comma separated list of category[:level]
+static void parse_categories(const char* list, int level)
+{
+    for (int c = 0; c < LOG_CATEGORY_COUNT; c++)
+    {
+        log_levels[c] = LOG_LEVEL_NONE;
+    }
+
+    while (*list != '\0')
+    {
+        size_t      len   = strcspn(list, ",");
+        const char* colon = (const char*) memchr(list, ':', len);
+        size_t      name  = (colon != NULL) ? (size_t) (colon - list) : len;
+
+        int c = 0;
+        while (c < LOG_CATEGORY_COUNT &&
+               (strlen(CATEGORY_NAMES[c]) != name || strncmp(CATEGORY_NAMES[c], list, name)))
+        {
+            c++;
+        }
+        if (c == LOG_CATEGORY_COUNT)
+        {
+            throw runtime_error(string("Error, unknown log category: ") + string(list, name));
+        }
+        log_levels[c] = (colon != NULL) ? parse_level(colon + 1, len - name - 1) : level;
+
+        list += len;
+        if (*list == ',')
+        {
+            list++;
+        }
+    }
+}
+
+// Writes the pending messages to the log file until log_close()
+static void* log_main(void*)
+{
+    vector<char> data;
+    pthread_mutex_lock(&log_lock);
+    while (true)
+    {
+        while (log_pending.size() < LOG_BATCH_SIZE && !log_stop)
+        {
+            pthread_cond_wait(&log_cond, &log_lock);
+        }
+        data.swap(log_pending);
+        bool stop = log_stop;
+        pthread_cond_broadcast(&log_cond);
+        pthread_mutex_unlock(&log_lock);
+
+        if (!data.empty())
+        {
+            fwrite(&data[0], 1, data.size(), log_file);
+            data.clear();
+        }
+
+        pthread_mutex_lock(&log_lock);
+        if (stop && log_pending.empty())
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&log_lock);
+    return NULL;
+}
+
+void log_init(unsigned int default_mask)
+{
+    const char* name  = option_string("log-level", "info");
+    int         level = parse_level(name, strlen(name));
+
+    const char* categories = option_string("log", NULL);
+    if (categories != NULL)
+    {
+        parse_categories(categories, level);
+    }
+    else
+    {
+        for (int c = 0; c < LOG_CATEGORY_COUNT; c++)
+        {
+            log_levels[c] = (default_mask & LOG_MASK(c)) ? level : LOG_LEVEL_NONE;
+        }
+    }
+
+    const char* filename = option_string("log-file", NULL);
+    log_file = stdout;
+    if (filename != NULL)
+    {
+        log_file = fopen(filename, "w");
+        if (log_file == NULL)
+        {
+            throw runtime_error(string("Unable to open file: ") + filename);
+        }
+    }
+
+    // Without a log thread, the messages are written by log_write()
+    log_stop     = false;
+    log_threaded = (pthread_create(&log_thread, NULL, log_main, NULL) == 0);
+
+    static bool registered = false;
+    if (!registered)
+    {
+        atexit(log_close);
+        registered = true;
+    }
+}
+
+void log_close()
+{
+    if (log_file == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&log_lock);
+    if (log_threaded)
+    {
+        log_stop = true;
+        pthread_cond_broadcast(&log_cond);
+        pthread_mutex_unlock(&log_lock);
+        pthread_join(log_thread, NULL);
+        log_threaded = false;
+    }
+    else
+    {
+        pthread_mutex_unlock(&log_lock);
+    }
+
+    if (log_file != stdout)
+    {
+        fclose(log_file);
+    }
+    else
+    {
+        fflush(log_file);
+    }
+    log_file = NULL;
+}
+
+void log_write(int level, log_category category, const string& message)
+{
+    if (log_file == NULL)
+    {
+        // Before log_init() or after log_close()
+        fprintf(stderr, "%s\n", message.c_str());
+        return;
+    }
+
+    char prefix[32];
+    int  len = snprintf(prefix, sizeof prefix, "[%s:%s] ",
+                        CATEGORY_NAMES[category], LEVEL_NAMES[level]);
+
+    pthread_mutex_lock(&log_lock);
+    while (log_threaded && log_pending.size() >= LOG_MAX_PENDING)
+    {
+        pthread_cond_wait(&log_cond, &log_lock);
+    }
+    log_pending.insert(log_pending.end(), prefix, prefix + len);
+    log_pending.insert(log_pending.end(), message.begin(), message.end());
+    log_pending.push_back('\n');
+
+    if (!log_threaded)
+    {
+        fwrite(&log_pending[0], 1, log_pending.size(), log_file);
+        log_pending.clear();
+    }
+    else if (log_pending.size() >= LOG_BATCH_SIZE)
+    {
+        pthread_cond_broadcast(&log_cond);
+    }
+    pthread_mutex_unlock(&log_lock);
+}
@@ -0,0 +1,131 @@
+/*
+// File: arbiter.cpp
+//
+// Arbitration of a bus between requesters, see arbiter.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include "arbiter.h"
+#include "aca2009.h"
+
+using namespace std;
+
+// Policies, in the order of arbiter_policy
+static const char* const POLICY_NAMES[] = { "rr", "fixed", "fcfs", "age" };
+
+static const unsigned int POLICY_COUNT = sizeof POLICY_NAMES / sizeof POLICY_NAMES[0];
+
+BusArbiter::BusArbiter(const char* name, unsigned int requesters, arbiter_policy policy)
+    : m_requesters(requesters), m_policy(policy), m_last(requesters - 1)
+{
+    if (requesters == 0)
+    {
+        throw runtime_error("Error, a bus needs at least one requester");
+    }
+
+    for (unsigned int i = 0; i < requesters; i++)
+    {
+        requester& r = m_requesters[i];
+        r.waiting    = false;
+        r.since      = 0;
+        r.last_grant = 0;
+
+        char prefix[64];
+        snprintf(prefix, sizeof prefix, "%s.cpu%u.", name, i);
+        r.grants  = metrics_counter((string(prefix) + "grants").c_str(), "Bus grants");
+        r.acquire = metrics_histogram_create((string(prefix) + "acquire_cycles").c_str(), 1, 256,
+                                             "Cycles from bus request to grant");
+    }
+}
+
+void BusArbiter::request(unsigned int id, uint64_t now)
+{
+    requester& r = m_requesters[id];
+    r.waiting = true;
+    r.since   = now;
+}
+
+bool BusArbiter::before(const requester& a, const requester& b) const
+{
+    switch (m_policy)
+    {
+        case ARBITER_FCFS:
+            // Requests of the same cycle go in scan order, i.e. by requester
+            // number, whatever order the simulator made them in
+            return a.since < b.since;
+
+        case ARBITER_AGE:
+            return a.last_grant < b.last_grant;
+
+        default:
+            // The requesters are compared in the order of the scan
+            return false;
+    }
+}
+
+int BusArbiter::grant(uint64_t now)
+{
+    unsigned int count = (unsigned int) m_requesters.size();
+
+    // Round-robin scans from the requester after the last one, the other
+    // policies from the first one, so that ties go to the lowest number
+    unsigned int first = (m_policy == ARBITER_ROUND_ROBIN) ? (m_last + 1) % count : 0;
+    int          best  = -1;
+    for (unsigned int n = 0; n < count; n++)
+    {
+        unsigned int i = (first + n) % count;
+        if (!m_requesters[i].waiting)
+        {
+            continue;
+        }
+        if (best < 0 || before(m_requesters[i], m_requesters[best]))
+        {
+            best = (int) i;
+            if (m_policy == ARBITER_ROUND_ROBIN || m_policy == ARBITER_FIXED)
+            {
+                break;
+            }
+        }
+    }
+
+    if (best >= 0)
+    {
+        requester& r = m_requesters[best];
+        r.waiting    = false;
+        r.last_grant = now;
+        (*r.grants)++;
+        metrics_histogram_add(r.acquire, now - r.since);
+        m_last = (unsigned int) best;
+    }
+    return best;
+}
+
+void BusArbiter::print() const
+{
+    printf("Bus arbitration (%s)\n", POLICY_NAMES[m_policy]);
+    printf("CPU\tGrants\tp50\tp99\tMax\n");
+    for (size_t i = 0; i < m_requesters.size(); i++)
+    {
+        const requester& r = m_requesters[i];
+        printf("%u\t%llu\t%llu\t%llu\t%llu\n", (unsigned int) i, (unsigned long long) *r.grants,
+               (unsigned long long) metrics_histogram_percentile(r.acquire, 0.50),
+               (unsigned long long) metrics_histogram_percentile(r.acquire, 0.99),
+               (unsigned long long) metrics_histogram_percentile(r.acquire, 1.0));
+    }
+}
+
+BusArbiter* arbiter_create(const char* name, unsigned int requesters)
+{
+    const char* policy = option_string((string(name) + "-arbiter").c_str(), "rr");
+    for (unsigned int p = 0; p < POLICY_COUNT; p++)
+    {
+        if (strcmp(POLICY_NAMES[p], policy) == 0)
+        {
+            return new BusArbiter(name, requesters, (arbiter_policy) p);
+        }
+    }
+    throw runtime_error(string("Error, unknown bus arbitration policy: ") + policy);
+}
@@ -0,0 +1,88 @@
+/*
+// File: arbiter.h
+//
+// Arbitration of a bus between requesters (the caches of the simulators).
+// A requester that wants the bus registers its request, and whenever the
+// bus is free the arbiter grants it to one of the waiting requesters, as
+// chosen by its policy:
+//   rr     Round-robin: the first waiting requester after the one that got
+//          the bus last (default)
+//   fixed  Fixed priority: the waiting requester with the lowest number,
+//          the others can starve
+//   fcfs   First come, first served: the requests are granted in the order
+//          of the cycles in which they were made
+//   age    The waiting requester that has gone the longest without the
+//          bus, so requesters that use the bus a lot yield to the others
+// Ties between requests made at the same time are broken by the requester
+// number.
+//
+// The arbiter only keeps the requests. It does not depend on SystemC: the
+// caller gives the current cycle, and wakes the requester that grant()
+// returns.
+//
+// The policy is selected with the --<name>-arbiter option (see init_options
+// in aca2009.h). The following metrics are registered per requester (see
+// metrics.h), with the name given to the constructor as prefix:
+// "<name>.cpu<N>.grants" and the histogram "<name>.cpu<N>.acquire_cycles"
+// of the cycles between a request and its grant.
+*/
+
+#ifndef ARBITER_H
+#define ARBITER_H
+
+#include <stdint.h>
+#include <vector>
+#include "metrics.h"
+
+enum arbiter_policy
+{
+    ARBITER_ROUND_ROBIN,
+    ARBITER_FIXED,
+    ARBITER_FCFS,
+    ARBITER_AGE
+};
+
+class BusArbiter
+{
+public:
+    BusArbiter(const char* name, unsigned int requesters, arbiter_policy policy);
+
+    // Registers that requester id wants the bus from cycle now on
+    void request(unsigned int id, uint64_t now);
+
+    /*
+     * Grants the bus at cycle now to one of the waiting requesters, and
+     * returns its number, or -1 when no requester is waiting.
+     */
+    int grant(uint64_t now);
+
+    arbiter_policy policy() const { return m_policy; }
+
+    // Pretty-prints the grants and acquisition times per requester
+    void print() const;
+
+private:
+    struct requester
+    {
+        bool               waiting;
+        uint64_t           since;       // cycle of the request
+        uint64_t           last_grant;  // cycle of the last grant
+        uint64_t*          grants;
+        metrics_histogram* acquire;
+    };
+
+    // Whether waiting requester a goes before waiting requester b
+    bool before(const requester& a, const requester& b) const;
+
+    std::vector<requester> m_requesters;
+    arbiter_policy         m_policy;
+    unsigned int           m_last;      // requester that got the bus last
+};
+
+/*
+ * Creates an arbiter for the given number of requesters with the policy
+ * given by the --<name>-arbiter option.
+ */
+BusArbiter* arbiter_create(const char* name, unsigned int requesters);
+
+#endif
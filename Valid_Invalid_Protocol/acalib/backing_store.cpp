@@ -0,0 +1,103 @@
+/*
+// File: backing_store.cpp
+//
+// Contents of the simulated main memory, see backing_store.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include "backing_store.h"
+
+using namespace std;
+
+// Pages per arena chunk (1 MB)
+static const unsigned int CHUNK_PAGES = 256;
+
+BackingStore::BackingStore()
+    : m_chunk_used(CHUNK_PAGES), m_pages(0)
+{
+    memset(m_tables, 0, sizeof(m_tables));
+}
+
+BackingStore::~BackingStore()
+{
+    for (unsigned int i = 0; i < TABLE_SIZE; i++)
+    {
+        free(m_tables[i]);
+    }
+    for (size_t i = 0; i < m_chunks.size(); i++)
+    {
+        free(m_chunks[i]);
+    }
+}
+
+const uint32_t* BackingStore::find_page(uint32_t addr) const
+{
+    uint32_t** table = m_tables[addr >> (PAGE_BITS + TABLE_BITS)];
+    if (table == NULL)
+    {
+        return NULL;
+    }
+    return table[(addr >> PAGE_BITS) & (TABLE_SIZE - 1)];
+}
+
+uint32_t* BackingStore::page(uint32_t addr)
+{
+    uint32_t**& table = m_tables[addr >> (PAGE_BITS + TABLE_BITS)];
+    if (table == NULL)
+    {
+        table = (uint32_t**) calloc(TABLE_SIZE, sizeof(uint32_t*));
+        if (table == NULL)
+        {
+            throw runtime_error(string("Error, unable to allocate backing store"));
+        }
+    }
+
+    uint32_t*& page = table[(addr >> PAGE_BITS) & (TABLE_SIZE - 1)];
+    if (page == NULL)
+    {
+        if (m_chunk_used == CHUNK_PAGES)
+        {
+            uint8_t* chunk = (uint8_t*) calloc(CHUNK_PAGES, PAGE_SIZE);
+            if (chunk == NULL)
+            {
+                throw runtime_error(string("Error, unable to allocate backing store"));
+            }
+            m_chunks.push_back(chunk);
+            m_chunk_used = 0;
+        }
+        page = (uint32_t*) (m_chunks.back() + (size_t) m_chunk_used * PAGE_SIZE);
+        m_chunk_used++;
+        m_pages++;
+    }
+    return page;
+}
+
+void BackingStore::read_line(uint32_t addr, uint32_t* data, unsigned int words) const
+{
+    const uint32_t* p = find_page(addr);
+    if (p == NULL)
+    {
+        memset(data, 0, words * sizeof(uint32_t));
+        return;
+    }
+    memcpy(data, p + ((addr & (PAGE_SIZE - 1)) >> 2), words * sizeof(uint32_t));
+}
+
+void BackingStore::write_line(uint32_t addr, const uint32_t* data, unsigned int words)
+{
+    memcpy(page(addr) + ((addr & (PAGE_SIZE - 1)) >> 2), data, words * sizeof(uint32_t));
+}
+
+uint32_t BackingStore::read_word(uint32_t addr) const
+{
+    const uint32_t* p = find_page(addr);
+    return (p != NULL) ? p[(addr & (PAGE_SIZE - 1)) >> 2] : 0;
+}
+
+void BackingStore::write_word(uint32_t addr, uint32_t value)
+{
+    page(addr)[(addr & (PAGE_SIZE - 1)) >> 2] = value;
+}
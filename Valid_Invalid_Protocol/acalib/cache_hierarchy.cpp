@@ -0,0 +1,311 @@
+/*
+// File: cache_hierarchy.cpp
+//
+// Cache levels below the L1 caches, see cache_hierarchy.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include "cache_hierarchy.h"
+#include "metrics.h"
+#include "aca2009.h"
+
+using namespace std;
+
+// Line states of the L2 and L3, which only hold tags
+static const int LEVEL_INVALID = 0;
+static const int LEVEL_VALID   = 1;
+
+static inclusion_policy parse_inclusion(const char* name)
+{
+    if (strcmp(name, "inclusive") == 0)
+    {
+        return INCLUSION_INCLUSIVE;
+    }
+    if (strcmp(name, "exclusive") == 0)
+    {
+        return INCLUSION_EXCLUSIVE;
+    }
+    if (strcmp(name, "nine") == 0)
+    {
+        return INCLUSION_NINE;
+    }
+    throw runtime_error(string("Error, unknown inclusion policy: ") + name);
+}
+
+CacheHierarchy::CacheHierarchy(unsigned int cpus, unsigned int line_size)
+    : m_cpus(cpus), m_line_size(line_size), m_bank_bits(0), m_offset_bits(cache_log2(line_size)),
+      m_invalidate(cpus, (hierarchy_invalidate) NULL), m_l1(cpus, (void*) NULL)
+{
+    m_inclusion   = parse_inclusion(option_string("inclusion", "nine"));
+    m_l2_latency  = (unsigned int) option_int("l2-latency", 10);
+    m_l3_latency  = (unsigned int) option_int("l3-latency", 30);
+    m_mem_latency = (unsigned int) option_int("mem-latency", 100);
+
+    unsigned int l2_size = (unsigned int) option_int("l2-size", 0);
+    if (l2_size > 0)
+    {
+        unsigned int ways   = (unsigned int) option_int("l2-ways", 8);
+        const char*  policy = option_string("l2-policy", "plru");
+        for (unsigned int i = 0; i < cpus; i++)
+        {
+            m_l2.push_back(cache_create(l2_size, ways, line_size, policy, LEVEL_INVALID));
+
+            char name[32];
+            level_stats stats;
+            sprintf(name, "cpu%u.l2hit", i);
+            stats.hit  = metrics_counter(name, "L2 hits");
+            sprintf(name, "cpu%u.l2miss", i);
+            stats.miss = metrics_counter(name, "L2 misses");
+            m_l2_stats.push_back(stats);
+        }
+    }
+
+    unsigned int l3_size = (unsigned int) option_int("l3-size", 0);
+    if (l3_size > 0)
+    {
+        unsigned int banks  = (unsigned int) option_int("l3-banks", 1);
+        unsigned int ways   = (unsigned int) option_int("l3-ways", 16);
+        const char*  policy = option_string("l3-policy", "plru");
+        if (!cache_is_pow2(banks) || banks > l3_size)
+        {
+            throw runtime_error("Error, the number of L3 banks must be a power of two");
+        }
+        m_bank_bits = cache_log2(banks);
+        for (unsigned int b = 0; b < banks; b++)
+        {
+            m_l3.push_back(cache_create(l3_size / banks, ways, line_size, policy, LEVEL_INVALID));
+
+            char name[32];
+            level_stats stats;
+            sprintf(name, "l3.bank%u.hit", b);
+            stats.hit  = metrics_counter(name, "L3 hits");
+            sprintf(name, "l3.bank%u.miss", b);
+            stats.miss = metrics_counter(name, "L3 misses");
+            m_l3_stats.push_back(stats);
+        }
+    }
+
+    m_mem_reads = metrics_counter("memory.reads", "Lines read from memory");
+    m_backinval = metrics_counter("l1.backinval", "L1 lines removed by inclusion");
+}
+
+CacheHierarchy::~CacheHierarchy()
+{
+    for (size_t i = 0; i < m_l2.size(); i++)
+    {
+        delete m_l2[i];
+    }
+    for (size_t i = 0; i < m_l3.size(); i++)
+    {
+        delete m_l3[i];
+    }
+}
+
+void CacheHierarchy::attach(uint32_t cpu, hierarchy_invalidate invalidate, void* l1)
+{
+    m_invalidate[cpu] = invalidate;
+    m_l1[cpu]         = l1;
+}
+
+// Consecutive lines go to consecutive banks, so the bank is taken from the
+// low bits of the line number and removed from the address within the bank
+uint32_t CacheHierarchy::bank_of(uint32_t addr) const
+{
+    return (addr >> m_offset_bits) & ((1u << m_bank_bits) - 1);
+}
+
+uint32_t CacheHierarchy::bank_addr(uint32_t addr) const
+{
+    return ((addr >> (m_offset_bits + m_bank_bits)) << m_offset_bits) | (addr & (m_line_size - 1));
+}
+
+uint32_t CacheHierarchy::line_addr(uint32_t bank, uint32_t set, uint32_t tag) const
+{
+    uint32_t addr = m_l3[bank]->addr_of(set, tag);
+    return (((addr >> m_offset_bits) << m_bank_bits) | bank) << m_offset_bits;
+}
+
+unsigned int CacheHierarchy::miss(uint32_t cpu, uint32_t addr)
+{
+    unsigned int latency = 0;
+    bool exclusive = (m_inclusion == INCLUSION_EXCLUSIVE);
+
+    if (!m_l2.empty())
+    {
+        CacheArray* l2  = m_l2[cpu];
+        int         way = l2->lookup(addr);
+        latency += m_l2_latency;
+        if (way >= 0)
+        {
+            (*m_l2_stats[cpu].hit)++;
+            if (exclusive)
+            {
+                // The line moves up to the L1
+                l2->set_state(l2->set_of(addr), way, LEVEL_INVALID);
+            }
+            else
+            {
+                l2->touch(l2->set_of(addr), way);
+            }
+            return latency;
+        }
+        (*m_l2_stats[cpu].miss)++;
+    }
+
+    if (!m_l3.empty())
+    {
+        uint32_t    bank  = bank_of(addr);
+        uint32_t    baddr = bank_addr(addr);
+        CacheArray* l3    = m_l3[bank];
+        int         way   = l3->lookup(baddr);
+        latency += m_l3_latency;
+        if (way >= 0)
+        {
+            (*m_l3_stats[bank].hit)++;
+            if (exclusive)
+            {
+                l3->set_state(l3->set_of(baddr), way, LEVEL_INVALID);
+            }
+            else
+            {
+                l3->touch(l3->set_of(baddr), way);
+                if (!m_l2.empty())
+                {
+                    fill_l2(cpu, addr);
+                }
+            }
+            return latency;
+        }
+        (*m_l3_stats[bank].miss)++;
+    }
+
+    latency += m_mem_latency;
+    (*m_mem_reads)++;
+    if (!exclusive)
+    {
+        if (!m_l3.empty())
+        {
+            fill_l3(addr);
+        }
+        if (!m_l2.empty())
+        {
+            fill_l2(cpu, addr);
+        }
+    }
+    return latency;
+}
+
+void CacheHierarchy::evict(uint32_t cpu, uint32_t addr)
+{
+    // Only an exclusive hierarchy takes in the lines the L1 evicts
+    if (m_inclusion != INCLUSION_EXCLUSIVE)
+    {
+        return;
+    }
+    if (!m_l2.empty())
+    {
+        fill_l2(cpu, addr);
+    }
+    else if (!m_l3.empty())
+    {
+        fill_l3(addr);
+    }
+}
+
+void CacheHierarchy::fill_l2(uint32_t cpu, uint32_t addr)
+{
+    CacheArray* l2  = m_l2[cpu];
+    uint32_t    set = l2->set_of(addr);
+    if (l2->lookup(addr) >= 0)
+    {
+        return;
+    }
+
+    unsigned int way = l2->victim(set);
+    if (l2->state(set, way) != LEVEL_INVALID)
+    {
+        uint32_t victim = l2->addr_of(set, l2->tag(set, way));
+        if (m_inclusion == INCLUSION_INCLUSIVE)
+        {
+            invalidate_l1(cpu, victim);
+        }
+        else if (m_inclusion == INCLUSION_EXCLUSIVE && !m_l3.empty())
+        {
+            fill_l3(victim);
+        }
+    }
+    l2->fill(set, way, l2->tag_of(addr), LEVEL_VALID);
+}
+
+void CacheHierarchy::fill_l3(uint32_t addr)
+{
+    uint32_t    bank  = bank_of(addr);
+    uint32_t    baddr = bank_addr(addr);
+    CacheArray* l3    = m_l3[bank];
+    uint32_t    set   = l3->set_of(baddr);
+    if (l3->lookup(baddr) >= 0)
+    {
+        return;
+    }
+
+    unsigned int way = l3->victim(set);
+    if (l3->state(set, way) != LEVEL_INVALID && m_inclusion == INCLUSION_INCLUSIVE)
+    {
+        // The L3 is shared, so the line can be in the L1 and L2 of any CPU
+        uint32_t victim = line_addr(bank, set, l3->tag(set, way));
+        for (uint32_t cpu = 0; cpu < m_cpus; cpu++)
+        {
+            if (!m_l2.empty())
+            {
+                invalidate_l2(cpu, victim);
+            }
+            invalidate_l1(cpu, victim);
+        }
+    }
+    l3->fill(set, way, l3->tag_of(baddr), LEVEL_VALID);
+}
+
+void CacheHierarchy::invalidate_l1(uint32_t cpu, uint32_t addr)
+{
+    if (m_invalidate[cpu] != NULL && m_invalidate[cpu](m_l1[cpu], addr))
+    {
+        (*m_backinval)++;
+    }
+}
+
+void CacheHierarchy::invalidate_l2(uint32_t cpu, uint32_t addr)
+{
+    CacheArray* l2  = m_l2[cpu];
+    int         way = l2->lookup(addr);
+    if (way >= 0)
+    {
+        l2->set_state(l2->set_of(addr), way, LEVEL_INVALID);
+    }
+}
+
+void CacheHierarchy::print() const
+{
+    static const char* const INCLUSION_NAMES[] = { "inclusive", "exclusive", "nine" };
+
+    printf("Level\tHits\tMisses\tHitrate\n");
+    for (size_t i = 0; i < m_l2_stats.size(); i++)
+    {
+        uint64_t hit  = *m_l2_stats[i].hit;
+        uint64_t miss = *m_l2_stats[i].miss;
+        printf("L2.%u\t%llu\t%llu\t%f\n", (unsigned int) i, (unsigned long long) hit,
+               (unsigned long long) miss, (hit + miss) ? hit * 100.0 / (hit + miss) : 0.0);
+    }
+    for (size_t b = 0; b < m_l3_stats.size(); b++)
+    {
+        uint64_t hit  = *m_l3_stats[b].hit;
+        uint64_t miss = *m_l3_stats[b].miss;
+        printf("L3.%u\t%llu\t%llu\t%f\n", (unsigned int) b, (unsigned long long) hit,
+               (unsigned long long) miss, (hit + miss) ? hit * 100.0 / (hit + miss) : 0.0);
+    }
+    printf("Memory reads: %llu, L1 back-invalidations: %llu (%s)\n",
+           (unsigned long long) *m_mem_reads, (unsigned long long) *m_backinval,
+           INCLUSION_NAMES[m_inclusion]);
+}
@@ -0,0 +1,328 @@
+/*
+// File: cache_model.h
+//
+// Set-associative cache model shared by the simulators. It holds the tags,
+// line states, data and replacement state of a cache, and does not depend
+// on SystemC: timing, statistics and the coherence protocol are left to the
+// caller, so the model can also be used in plain C++ tools.
+//
+// CacheModel is a template on the size, associativity and line size in
+// bytes, which must all be powers of two, and on a replacement policy (see
+// cache_policy.h). The address is split into tag, set and offset with shifts
+// and masks that are computed at compile time, and the policy is called
+// directly, so choosing a victim costs no virtual call.
+//
+// The simulators use a cache through the CacheArray interface, and create it
+// with cache_create(), which picks one of a table of pre-instantiated
+// geometries and policies at run-time. The geometry and policy can then be
+// chosen on the command line without rebuilding the simulator.
+//
+// The tags, line states and data are stored as separate arrays, with the
+// tags of a set contiguous, and a set is searched with one SIMD compare of
+// all its tags (see cache_match_tags).
+//
+// A line state is a small integer (0 to 255) chosen by the caller, the state
+// that marks an invalid line is given when the cache is created.
+*/
+
+#ifndef CACHE_MODEL_H
+#define CACHE_MODEL_H
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "cache_policy.h"
+
+/*
+ * Interface of a cache of any geometry. Ways are numbered 0 to ways() - 1,
+ * lookups return -1 when no way qualifies.
+ */
+class CacheArray
+{
+public:
+    virtual ~CacheArray() {}
+
+    virtual unsigned int size() const      = 0;
+    virtual unsigned int ways() const      = 0;
+    virtual unsigned int line_size() const = 0;
+    virtual unsigned int sets() const      = 0;
+
+    // Decomposes an address into set index, tag and word within the line
+    virtual uint32_t set_of(uint32_t addr) const  = 0;
+    virtual uint32_t tag_of(uint32_t addr) const  = 0;
+    virtual uint32_t word_of(uint32_t addr) const = 0;
+
+    // Address of the first byte of the line with the given set and tag
+    virtual uint32_t addr_of(uint32_t set, uint32_t tag) const = 0;
+
+    // Invalidates all lines and resets the replacement state
+    virtual void clear() = 0;
+
+    // First way of the set that holds tag, in any state including invalid
+    virtual int find(uint32_t set, uint32_t tag) const = 0;
+
+    // Way that holds addr in a valid state
+    virtual int lookup(uint32_t addr) const = 0;
+
+    // First invalid way of the set
+    virtual int invalid_way(uint32_t set) const = 0;
+
+    // Way to fill next: the first invalid way, or else the one chosen by the
+    // replacement policy
+    virtual unsigned int victim(uint32_t set) const = 0;
+
+    // Records a hit on a way for the replacement policy
+    virtual void touch(uint32_t set, unsigned int way) = 0;
+
+    // Puts tag in a way with the given state and records the fill for the
+    // replacement policy, the data is left to the caller
+    virtual void fill(uint32_t set, unsigned int way, uint32_t tag, int state) = 0;
+
+    // Contents of a line, data() points to line_size() / 4 words
+    virtual uint32_t  tag(uint32_t set, unsigned int way) const   = 0;
+    virtual int       state(uint32_t set, unsigned int way) const = 0;
+    virtual void      set_state(uint32_t set, unsigned int way, int state) = 0;
+    virtual uint32_t* data(uint32_t set, unsigned int way) = 0;
+
+    virtual int invalid_state() const = 0;
+
+    // Name of the replacement policy, as given to cache_create()
+    virtual const char* policy() const = 0;
+};
+
+/*
+ * Bit mask of the ways of a set whose tag equals tag, bit w for way w. The
+ * tags of a set are contiguous, so they are compared in one or a few vector
+ * instructions: AVX2 when compiled with -mavx2 (or -march=native), otherwise
+ * SSE2, which every x86-64 compiler enables.
+ */
+template <unsigned int Ways>
+inline uint64_t cache_match_tags(const uint32_t* tags, uint32_t tag)
+{
+    uint64_t mask = 0;
+#if defined(__AVX2__)
+    if (Ways % 8 == 0)
+    {
+        __m256i key = _mm256_set1_epi32((int) tag);
+        for (unsigned int w = 0; w < Ways; w += 8)
+        {
+            __m256i row = _mm256_loadu_si256((const __m256i*) (tags + w));
+            __m256i eq  = _mm256_cmpeq_epi32(row, key);
+            mask |= (uint64_t) (unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << w;
+        }
+        return mask;
+    }
+#endif
+#if defined(__SSE2__)
+    if (Ways % 4 == 0)
+    {
+        __m128i key = _mm_set1_epi32((int) tag);
+        for (unsigned int w = 0; w < Ways; w += 4)
+        {
+            __m128i row = _mm_loadu_si128((const __m128i*) (tags + w));
+            __m128i eq  = _mm_cmpeq_epi32(row, key);
+            mask |= (uint64_t) (unsigned int) _mm_movemask_ps(_mm_castsi128_ps(eq)) << w;
+        }
+        return mask;
+    }
+#endif
+    for (unsigned int w = 0; w < Ways; w++)
+    {
+        mask |= (uint64_t) (tags[w] == tag) << w;
+    }
+    return mask;
+}
+
+template <unsigned int Size, unsigned int Ways, unsigned int LineSize, class Policy>
+class CacheModel final : public CacheArray
+{
+public:
+    static constexpr unsigned int SIZE        = Size;
+    static constexpr unsigned int WAYS        = Ways;
+    static constexpr unsigned int LINE_SIZE   = LineSize;
+    static constexpr unsigned int SETS        = Size / (Ways * LineSize);
+    static constexpr unsigned int WORDS       = LineSize / 4;
+    static constexpr unsigned int OFFSET_BITS = cache_log2(LineSize);
+    static constexpr unsigned int SET_BITS    = cache_log2(SETS);
+    static constexpr uint32_t     SET_MASK    = SETS - 1;
+
+    static_assert(cache_is_pow2(Size) && cache_is_pow2(Ways) && cache_is_pow2(LineSize),
+                  "Cache size, associativity and line size must be powers of two");
+    static_assert(LineSize >= 4 && Size >= Ways * LineSize,
+                  "A cache needs at least one set of lines of one word");
+    static_assert(Ways <= 64, "A set holds at most 64 ways");
+
+    // Tag of a line that holds no address
+    static constexpr uint32_t NO_TAG = 0xFFFFFFFF;
+
+    // Mask of all ways of a set
+    static constexpr uint64_t ALL_WAYS = (Ways == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << Ways) - 1;
+
+    // Compile-time decomposition of an address
+    static uint32_t addr_set(uint32_t addr)  { return (addr >> OFFSET_BITS) & SET_MASK; }
+    static uint32_t addr_tag(uint32_t addr)  { return (uint32_t) ((uint64_t) addr >> (OFFSET_BITS + SET_BITS)); }
+    static uint32_t addr_word(uint32_t addr) { return (addr & (LineSize - 1)) >> 2; }
+
+    explicit CacheModel(int invalid_state = 0, const char* policy = "")
+        : m_invalid(invalid_state), m_policy(policy)
+    {
+        m_tags   = new uint32_t[SETS * WAYS];
+        m_states = new uint8_t[SETS * WAYS];
+        m_valid  = new uint64_t[SETS];
+        m_data   = new uint32_t[SETS * WAYS * WORDS];
+        m_repl   = new typename Policy::state_type[SETS];
+        clear();
+    }
+
+    ~CacheModel()
+    {
+        delete[] m_tags;
+        delete[] m_states;
+        delete[] m_valid;
+        delete[] m_data;
+        delete[] m_repl;
+    }
+
+    unsigned int size() const      { return SIZE; }
+    unsigned int ways() const      { return WAYS; }
+    unsigned int line_size() const { return LINE_SIZE; }
+    unsigned int sets() const      { return SETS; }
+
+    uint32_t set_of(uint32_t addr) const  { return addr_set(addr); }
+    uint32_t tag_of(uint32_t addr) const  { return addr_tag(addr); }
+    uint32_t word_of(uint32_t addr) const { return addr_word(addr); }
+
+    uint32_t addr_of(uint32_t set, uint32_t tag) const
+    {
+        return (uint32_t) (((uint64_t) tag << (OFFSET_BITS + SET_BITS)) | (set << OFFSET_BITS));
+    }
+
+    void clear()
+    {
+        for (unsigned int i = 0; i < SETS * WAYS; i++)
+        {
+            m_tags[i]   = NO_TAG;
+            m_states[i] = (uint8_t) m_invalid;
+        }
+        for (unsigned int s = 0; s < SETS; s++)
+        {
+            m_valid[s] = 0;
+            Policy::reset(m_repl[s]);
+        }
+        memset(m_data, 0, sizeof(uint32_t) * SETS * WAYS * WORDS);
+    }
+
+    int find(uint32_t set, uint32_t tag) const
+    {
+        return first_way(cache_match_tags<Ways>(m_tags + set * WAYS, tag));
+    }
+
+    int lookup(uint32_t addr) const
+    {
+        uint32_t set = addr_set(addr);
+        return first_way(cache_match_tags<Ways>(m_tags + set * WAYS, addr_tag(addr)) & m_valid[set]);
+    }
+
+    int invalid_way(uint32_t set) const
+    {
+        return first_way(~m_valid[set] & ALL_WAYS);
+    }
+
+    unsigned int victim(uint32_t set) const
+    {
+        int way = invalid_way(set);
+        if (way >= 0)
+        {
+            return way;
+        }
+        return Policy::victim(m_repl[set]);
+    }
+
+    void touch(uint32_t set, unsigned int way)
+    {
+        Policy::touch(m_repl[set], way);
+    }
+
+    void fill(uint32_t set, unsigned int way, uint32_t tag, int state)
+    {
+        m_tags[set * WAYS + way] = tag;
+        set_state(set, way, state);
+        Policy::insert(m_repl[set], way);
+    }
+
+    uint32_t tag(uint32_t set, unsigned int way) const
+    {
+        return m_tags[set * WAYS + way];
+    }
+
+    int state(uint32_t set, unsigned int way) const
+    {
+        return m_states[set * WAYS + way];
+    }
+
+    void set_state(uint32_t set, unsigned int way, int state)
+    {
+        m_states[set * WAYS + way] = (uint8_t) state;
+        if (state != m_invalid)
+        {
+            m_valid[set] |= (uint64_t) 1 << way;
+        }
+        else
+        {
+            m_valid[set] &= ~((uint64_t) 1 << way);
+        }
+    }
+
+    uint32_t* data(uint32_t set, unsigned int way)
+    {
+        return m_data + (set * WAYS + way) * WORDS;
+    }
+
+    int invalid_state() const { return m_invalid; }
+
+    const char* policy() const { return m_policy; }
+
+private:
+    static int first_way(uint64_t mask)
+    {
+        return (mask != 0) ? __builtin_ctzll(mask) : -1;
+    }
+
+    // Not copyable
+    CacheModel(const CacheModel&);
+    CacheModel& operator=(const CacheModel&);
+
+    // Structure of arrays, indexed by set * WAYS + way (times WORDS for the
+    // data), so that a lookup only touches the tags and valid mask of a set
+    uint32_t*                     m_tags;
+    uint8_t*                      m_states;
+    uint64_t*                     m_valid;     // bit per way, set if not invalid
+    uint32_t*                     m_data;
+    typename Policy::state_type*  m_repl;
+    int                           m_invalid;
+    const char*                   m_policy;
+};
+
+/*
+ * Creates a cache of the given geometry and replacement policy (lru, plru,
+ * srrip, brrip or random), from the table of pre-instantiated geometries:
+ * sizes of 1 kB to 4 MB, 1 to 16 ways and 32 byte lines, or lines of 16 to
+ * 128 bytes when acalib is built with CACHE_ALL_LINES=1 (ALL_LINES=1 in the
+ * Makefile). Throws a runtime_error for a geometry or policy that is not in
+ * the table.
+ */
+CacheArray* cache_create(unsigned int size, unsigned int ways, unsigned int line_size,
+                         const char* policy, int invalid_state);
+
+/*
+ * Creates a cache with the geometry and policy given by the options
+ * --<name>-size, --<name>-ways, --<name>-line and --<name>-policy (see
+ * init_options in aca2009.h), e.g. --l1-size=65536 --l1-policy=srrip, or the
+ * given defaults and tree pseudo-LRU.
+ */
+CacheArray* cache_create(const char* name, unsigned int size, unsigned int ways,
+                         unsigned int line_size, int invalid_state);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+// File: cache_policy.h
+//
+// Replacement policies for CacheModel (see cache_model.h). A policy keeps a
+// small state per set and is a class of static functions, so that the cache
+// model is specialised for it at compile time:
+//
+//   struct Policy
+//   {
+//       typedef ... state_type;
+//       static void         reset(state_type& s);
+//       static unsigned int victim(const state_type& s);
+//       static void         touch(state_type& s, unsigned int way);
+//       static void         insert(state_type& s, unsigned int way);
+//   };
+//
+// victim() returns the way to replace when the set holds no invalid line,
+// touch() records a hit on a way and insert() records that a way was filled.
+//
+// The policies are:
+//   lru     True LRU with an age counter per way
+//   plru    Tree pseudo-LRU with Ways - 1 bits per set
+//   srrip   Static re-reference interval prediction with 2 bit counters:
+//           lines are filled with a long re-reference interval and promoted
+//           on a hit
+//   brrip   Bimodal RRIP: as srrip, but only one in 32 fills of a set gets a
+//           long interval, the others a distant one, which resists scans
+//   random  Pseudo-random victims from a xorshift generator per set
+*/
+
+#ifndef CACHE_POLICY_H
+#define CACHE_POLICY_H
+
+#include <stdint.h>
+#include <type_traits>
+
+// Base 2 logarithm of a power of two
+constexpr unsigned int cache_log2(unsigned int n)
+{
+    return (n <= 1) ? 0 : 1 + cache_log2(n / 2);
+}
+
+constexpr bool cache_is_pow2(unsigned int n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+/*
+ * True LRU. Each way has an age from 0 (most recently used) to Ways - 1
+ * (least recently used), the ages of a set are always a permutation.
+ */
+template <unsigned int Ways>
+struct TrueLRU
+{
+    struct state_type
+    {
+        uint8_t age[Ways];
+    };
+
+    static void reset(state_type& s)
+    {
+        for (unsigned int w = 0; w < Ways; w++)
+        {
+            s.age[w] = (uint8_t) w;
+        }
+    }
+
+    static unsigned int victim(const state_type& s)
+    {
+        for (unsigned int w = 0; w < Ways; w++)
+        {
+            if (s.age[w] == Ways - 1)
+            {
+                return w;
+            }
+        }
+        return 0;
+    }
+
+    static void touch(state_type& s, unsigned int way)
+    {
+        uint8_t age = s.age[way];
+        for (unsigned int w = 0; w < Ways; w++)
+        {
+            if (s.age[w] < age)
+            {
+                s.age[w]++;
+            }
+        }
+        s.age[way] = 0;
+    }
+
+    static void insert(state_type& s, unsigned int way)
+    {
+        touch(s, way);
+    }
+};
+
+/*
+ * Tree pseudo-LRU for any power-of-two number of ways, in Ways - 1 bits per
+ * set. The bits are the nodes of a binary tree in heap order: bit 0 is the
+ * root and the children of bit n are bits 2n+1 and 2n+2. A cleared bit points
+ * to the left subtree as the victim, a use points all nodes on its path away
+ * from it. For 8 ways this is the 7 bit encoding the simulators always used.
+ */
+template <unsigned int Ways>
+struct TreePLRU
+{
+    static_assert(cache_is_pow2(Ways) && Ways <= 64, "TreePLRU needs 1 to 64 ways, a power of two");
+
+    typedef typename std::conditional<(Ways <= 8),  uint8_t,
+            typename std::conditional<(Ways <= 16), uint16_t,
+            typename std::conditional<(Ways <= 32), uint32_t, uint64_t>::type>::type>::type state_type;
+
+    static void reset(state_type& s)
+    {
+        s = 0;
+    }
+
+    static unsigned int victim(const state_type& s)
+    {
+        unsigned int node = 0;
+        for (unsigned int level = 0; level < cache_log2(Ways); level++)
+        {
+            node = 2 * node + 1 + ((s >> node) & 1);
+        }
+        return node - (Ways - 1);
+    }
+
+    static void touch(state_type& s, unsigned int way)
+    {
+        unsigned int node = way + (Ways - 1);
+        while (node > 0)
+        {
+            unsigned int parent = (node - 1) / 2;
+            if (node == 2 * parent + 1)
+            {
+                s |= (state_type) ((state_type) 1 << parent);
+            }
+            else
+            {
+                s &= (state_type) ~((state_type) 1 << parent);
+            }
+            node = parent;
+        }
+    }
+
+    static void insert(state_type& s, unsigned int way)
+    {
+        touch(s, way);
+    }
+};
+
+/*
+ * Re-reference interval prediction (Jaleel et al., ISCA 2010) with 2 bit
+ * re-reference prediction values (RRPV). The victim is the first way with
+ * the largest RRPV; before a fill all RRPVs of the set are aged by as much
+ * as it takes to bring that way to the distant value, which gives the same
+ * result as the usual search-and-increment loop. Bimodal selects BRRIP.
+ */
+template <unsigned int Ways, bool Bimodal>
+struct RRIP
+{
+    static const uint8_t RRPV_MAX  = 3;     // distant re-reference
+    static const uint8_t RRPV_LONG = 2;     // long re-reference
+    static const uint8_t BIP_RATE  = 32;    // BRRIP fills one in this many as long
+
+    struct state_type
+    {
+        uint8_t rrpv[Ways];
+        uint8_t fills;
+    };
+
+    static void reset(state_type& s)
+    {
+        for (unsigned int w = 0; w < Ways; w++)
+        {
+            s.rrpv[w] = RRPV_MAX;
+        }
+        s.fills = 0;
+    }
+
+    static unsigned int victim(const state_type& s)
+    {
+        unsigned int way = 0;
+        for (unsigned int w = 1; w < Ways; w++)
+        {
+            if (s.rrpv[w] > s.rrpv[way])
+            {
+                way = w;
+            }
+        }
+        return way;
+    }
+
+    static void touch(state_type& s, unsigned int way)
+    {
+        s.rrpv[way] = 0;
+    }
+
+    static void insert(state_type& s, unsigned int way)
+    {
+        uint8_t age = RRPV_MAX - s.rrpv[victim(s)];
+        if (age > 0)
+        {
+            for (unsigned int w = 0; w < Ways; w++)
+            {
+                s.rrpv[w] += age;
+            }
+        }
+
+        if (!Bimodal)
+        {
+            s.rrpv[way] = RRPV_LONG;
+        }
+        else
+        {
+            s.rrpv[way] = (s.fills == 0) ? RRPV_LONG : RRPV_MAX;
+            s.fills = (uint8_t) ((s.fills + 1) % BIP_RATE);
+        }
+    }
+};
+
+/*
+ * Random replacement. The victim is taken from a xorshift generator per set,
+ * which advances on every fill, so victim() returns the same way until the
+ * set is filled.
+ */
+template <unsigned int Ways>
+struct RandomPolicy
+{
+    typedef uint32_t state_type;
+
+    static void reset(state_type& s)
+    {
+        s = 0x9E3779B9;
+    }
+
+    static unsigned int victim(const state_type& s)
+    {
+        return (unsigned int) (((uint64_t) s * Ways) >> 32);
+    }
+
+    static void touch(state_type&, unsigned int)
+    {
+    }
+
+    static void insert(state_type& s, unsigned int)
+    {
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+    }
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*
+// File: directory.h
+//
+// Directory for directory-based coherence between the L1 caches, as an
+// alternative to snooping a broadcast bus. The directory sits at the memory
+// side and knows for every line which caches hold it and which one owns it
+// (holds it MODIFIED, OWNED or EXCLUSIVE), so a miss only involves the
+// caches that hold the line: a read is forwarded to the owner, which
+// supplies the line and keeps a copy, and a write invalidates the sharers.
+// The caches tell the directory when they evict a line, so it stays exact.
+//
+// The directory is sparse: it only has entries for lines that are cached,
+// kept in a set-associative array of line addresses with LRU replacement.
+// It holds no data, so it is not limited to the geometries of the cache
+// model. When a set is full, the replaced entry is recalled: its
+// line is invalidated in all caches that hold it. Each entry holds either
+// a full bit vector of sharers, or a limited number of pointers to sharers;
+// when more caches share the line than there are pointers, the entry
+// overflows and invalidations go to all caches.
+//
+// Messages travel over a point-to-point network that takes a fixed number
+// of cycles per hop and does not serialise them, so the number of caches is
+// not limited by a bus. A miss takes a hop to the directory, the directory
+// lookup, and a hop back or, when it is forwarded, a hop to the owner and a
+// hop from the owner to the requester. Invalidations go out in parallel and
+// take a hop there and a hop back for the acknowledgement.
+//
+// The directory does not depend on SystemC: it calls the probe function of
+// the caches it sends messages to, and returns the cycles the miss takes
+// without the memory access, which the caller adds when no cache supplied
+// the line. The following options are used (see init_options in
+// aca2009.h):
+//   --dir-entries=<n>      Directory entries, a power of two (default: given
+//                          by the simulator, twice the lines of all L1s)
+//   --dir-ways=<n>         Associativity of the directory (default: 8)
+//   --dir-pointers=<n>     Sharer pointers per entry, 0 for a full bit
+//                          vector (default: 0)
+//   --dir-latency=<cycles> Directory lookup (default: 10)
+//   --net-latency=<cycles> Network hop (default: 2)
+//
+// The following metrics are registered (see metrics.h): "dir.requests",
+// "dir.forwards", "dir.invalidations" (invalidation messages),
+// "dir.broadcasts" (invalidations of overflowed entries), "dir.recalls"
+// (replaced entries that still had sharers) and the histogram "dir.sharers"
+// of the other sharers of a line that is written.
+*/
+
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stdint.h>
+#include <vector>
+#include "metrics.h"
+
+// Messages the directory sends to a cache that holds a line
+enum directory_probe_type
+{
+    DIRECTORY_FORWARD,          // supply the line to a reader and keep a copy
+    DIRECTORY_FETCH_INVALIDATE, // supply the line to a writer and drop it
+    DIRECTORY_INVALIDATE        // drop the line, the writer has its data
+};
+
+/*
+ * Handles a message of the directory for the line holding addr in a cache.
+ * cache is the pointer given to Directory::attach(). Returns whether the
+ * cache supplied the line, i.e. held it MODIFIED, OWNED or EXCLUSIVE.
+ */
+typedef bool (*directory_probe)(void* cache, uint32_t addr, directory_probe_type type);
+
+// Outcome of a miss or upgrade
+struct directory_result
+{
+    bool         supplied;  // another cache supplied the line
+    bool         shared;    // other caches keep a copy
+    unsigned int latency;   // cycles, without the memory access
+};
+
+class Directory
+{
+public:
+    // A directory for cpus caches with lines of line_size bytes, with
+    // entries entries unless --dir-entries is given
+    Directory(unsigned int cpus, unsigned int line_size, unsigned int entries);
+
+    // Sets the function that handles the messages to the cache of cpu
+    void attach(uint32_t cpu, directory_probe probe, void* cache);
+
+    // Read miss of cpu on the line holding addr
+    directory_result read(uint32_t cpu, uint32_t addr);
+
+    // Write miss of cpu: the other copies are fetched and invalidated
+    directory_result read_exclusive(uint32_t cpu, uint32_t addr);
+
+    // Write hit of cpu on a shared line: the other copies are invalidated
+    directory_result upgrade(uint32_t cpu, uint32_t addr);
+
+    // Tells the directory that the cache of cpu evicted the line holding addr
+    void evict(uint32_t cpu, uint32_t addr);
+
+    // Pretty-prints the messages
+    void print() const;
+
+private:
+    // Entry of the line holding addr, or -1 if it has none
+    int find(uint32_t addr) const;
+
+    // Entry of the line holding addr, allocated when needed
+    unsigned int entry(uint32_t addr);
+
+    // Sends a message to all caches but cpu that hold the line of entry e,
+    // returns whether one of them supplied the line
+    bool probe_sharers(unsigned int e, uint32_t cpu, uint32_t addr, directory_probe_type type);
+
+    // Whether a cache other than cpu holds the line of entry e
+    bool other_sharers(unsigned int e, uint32_t cpu) const;
+
+    void add_sharer(unsigned int e, uint32_t cpu);
+    void clear_sharers(unsigned int e);
+    bool is_sharer(unsigned int e, uint32_t cpu) const;
+
+    // Not copyable
+    Directory(const Directory&);
+    Directory& operator=(const Directory&);
+
+    unsigned int               m_cpus;
+    unsigned int               m_words;         // bit vector words per entry
+    unsigned int               m_pointers;      // 0 for a full bit vector
+    unsigned int               m_dir_latency;
+    unsigned int               m_net_latency;
+    unsigned int               m_sets;
+    unsigned int               m_ways;
+    unsigned int               m_offset_bits;   // log2 of the line size
+    uint64_t                   m_clock;         // accesses so far, for LRU
+    std::vector<uint32_t>      m_lines;         // line address per entry
+    std::vector<bool>          m_valid;         // per entry
+    std::vector<uint64_t>      m_used;          // per entry, last access
+    std::vector<uint64_t>      m_sharers;       // bit vector per entry
+    std::vector<unsigned int>  m_count;         // sharers per entry
+    std::vector<int>           m_owner;         // per entry, -1 for none
+    std::vector<bool>          m_overflow;      // per entry, more sharers than pointers
+    std::vector<directory_probe> m_probe;
+    std::vector<void*>         m_caches;
+
+    uint64_t*                  m_requests;
+    uint64_t*                  m_forwards;
+    uint64_t*                  m_invalidations;
+    uint64_t*                  m_broadcasts;
+    uint64_t*                  m_recalls;
+    metrics_histogram*         m_written_sharers;
+};
+
+#endif
@@ -0,0 +1,529 @@
+/*
+// File: metrics.cpp
+//
+// Registry of named counters and histograms, see metrics.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <deque>
+#include <string.h>
+#include "metrics.h"
+
+using namespace std;
+
+struct metrics_histogram
+{
+    string           name;
+    string           description;
+    uint64_t         bucket_width;
+    vector<uint64_t> buckets;
+    uint64_t         count;
+    uint64_t         sum;
+    uint64_t         max;
+};
+
+struct metric
+{
+    string          name;
+    string          description;
+    const uint64_t* value;
+};
+
+static vector<metric>              metrics;
+static deque<uint64_t>             owned_counters;
+static deque<metrics_histogram>    histograms;
+static FILE*                       interval_file = NULL;
+static uint64_t                    interval      = 0;
+
+// Zero makes the first metrics_tick() read the interval options
+uint64_t metrics_next_interval = 0;
+
+// Epoch sampling state, set up by the first call of metrics_sample()
+static bool                    sample_configured = false;
+static bool                    sample_by_access  = false;
+static uint64_t                sample_length     = 0;   // Epoch length
+static size_t                  sample_capacity   = 0;   // Epochs in the table
+static size_t                  sample_count      = 0;   // Epochs recorded
+static vector<const uint64_t*> sample_counters;
+static vector<uint64_t>        sample_previous;         // Values at last epoch
+static vector<uint32_t>        sample_table;
+
+// Zero makes the first metrics_tick()/metrics_access() read the options
+uint64_t metrics_next_sample_cycle  = 0;
+uint64_t metrics_next_sample_access = 0;
+uint64_t metrics_accesses           = 0;
+uint64_t metrics_now                = 0;
+
+uint64_t* metrics_counter(const char* name, const char* description)
+{
+    for (size_t i = 0; i < metrics.size(); i++)
+    {
+        if (metrics[i].name == name)
+        {
+            return const_cast<uint64_t*>(metrics[i].value);
+        }
+    }
+
+    owned_counters.push_back(0);
+    metrics_register(name, &owned_counters.back(), description);
+    return &owned_counters.back();
+}
+
+void metrics_register(const char* name, const uint64_t* value, const char* description)
+{
+    metric m;
+    m.name        = name;
+    m.description = description;
+    m.value       = value;
+    metrics.push_back(m);
+}
+
+metrics_histogram* metrics_histogram_create(const char* name, uint64_t bucket_width,
+                                            unsigned int bucket_count,
+                                            const char* description)
+{
+    for (size_t i = 0; i < histograms.size(); i++)
+    {
+        if (histograms[i].name == name)
+        {
+            return &histograms[i];
+        }
+    }
+
+    if (bucket_width == 0 || bucket_count == 0)
+    {
+        throw runtime_error(string("Error, histogram without buckets: ") + name);
+    }
+
+    histograms.push_back(metrics_histogram());
+    metrics_histogram& h = histograms.back();
+    h.name         = name;
+    h.description  = description;
+    h.bucket_width = bucket_width;
+    h.buckets.resize(bucket_count);
+    h.count        = 0;
+    h.sum          = 0;
+    h.max          = 0;
+    return &h;
+}
+
+void metrics_histogram_add(metrics_histogram* h, uint64_t value)
+{
+    uint64_t bucket = value / h->bucket_width;
+    if (bucket >= h->buckets.size())
+    {
+        bucket = h->buckets.size() - 1;
+    }
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+    {
+        h->max = value;
+    }
+}
+
+uint64_t metrics_histogram_count(const metrics_histogram* h)
+{
+    return h->count;
+}
+
+uint64_t metrics_histogram_percentile(const metrics_histogram* h, double fraction)
+{
+    if (h->count == 0)
+    {
+        return 0;
+    }
+
+    // Upper bound of the bucket holding the requested value
+    uint64_t rank = (uint64_t) (fraction * h->count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < h->buckets.size(); i++)
+    {
+        seen += h->buckets[i];
+        if (seen > rank)
+        {
+            // The last bucket also holds all larger values
+            uint64_t bound = (i + 1) * h->bucket_width - 1;
+            return (bound < h->max && i + 1 < h->buckets.size()) ? bound : h->max;
+        }
+    }
+    return h->max;
+}
+
+static uint64_t read_value(const uint64_t* value)
+{
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+// Writes a string as a JSON string
+static void write_json_string(FILE* f, const string& s)
+{
+    fputc('"', f);
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if (s[i] == '"' || s[i] == '\\')
+        {
+            fputc('\\', f);
+        }
+        fputc(s[i], f);
+    }
+    fputc('"', f);
+}
+
+// Writes the counters and histograms as the members of a JSON object
+static void write_json_members(FILE* f, const char* separator)
+{
+    fprintf(f, "\"counters\":{");
+    for (size_t i = 0; i < metrics.size(); i++)
+    {
+        fprintf(f, "%s%s", (i > 0) ? "," : "", separator);
+        write_json_string(f, metrics[i].name);
+        fprintf(f, ":%llu", (unsigned long long) read_value(metrics[i].value));
+    }
+    fprintf(f, "},%s\"histograms\":{", separator);
+    for (size_t i = 0; i < histograms.size(); i++)
+    {
+        const metrics_histogram& h = histograms[i];
+        fprintf(f, "%s%s", (i > 0) ? "," : "", separator);
+        write_json_string(f, h.name);
+        fprintf(f, ":{\"count\":%llu,\"sum\":%llu,\"max\":%llu,\"p50\":%llu,"
+                   "\"p99\":%llu,\"bucket_width\":%llu,\"buckets\":[",
+                (unsigned long long) h.count, (unsigned long long) h.sum,
+                (unsigned long long) h.max,
+                (unsigned long long) metrics_histogram_percentile(&h, 0.50),
+                (unsigned long long) metrics_histogram_percentile(&h, 0.99),
+                (unsigned long long) h.bucket_width);
+        for (size_t b = 0; b < h.buckets.size(); b++)
+        {
+            fprintf(f, "%s%llu", (b > 0) ? "," : "", (unsigned long long) h.buckets[b]);
+        }
+        fprintf(f, "]}");
+    }
+    fprintf(f, "}");
+}
+
+void metrics_write_json(FILE* f)
+{
+    fprintf(f, "{\n");
+    write_json_members(f, "\n  ");
+    fprintf(f, "\n}\n");
+}
+
+void metrics_write_csv(FILE* f)
+{
+    fprintf(f, "metric,value\n");
+    for (size_t i = 0; i < metrics.size(); i++)
+    {
+        fprintf(f, "%s,%llu\n", metrics[i].name.c_str(),
+                (unsigned long long) read_value(metrics[i].value));
+    }
+
+    // Histograms are summarized, the buckets are only in the JSON output
+    for (size_t i = 0; i < histograms.size(); i++)
+    {
+        const metrics_histogram& h = histograms[i];
+        const char* name = h.name.c_str();
+        fprintf(f, "%s.count,%llu\n", name, (unsigned long long) h.count);
+        fprintf(f, "%s.sum,%llu\n",   name, (unsigned long long) h.sum);
+        fprintf(f, "%s.max,%llu\n",   name, (unsigned long long) h.max);
+        fprintf(f, "%s.p50,%llu\n",   name,
+                (unsigned long long) metrics_histogram_percentile(&h, 0.50));
+        fprintf(f, "%s.p99,%llu\n",   name,
+                (unsigned long long) metrics_histogram_percentile(&h, 0.99));
+    }
+}
+
+// Records the growth of all counters since the previous epoch as the next
+// epoch. When the table is full, pairs of epochs are merged into one.
+static void take_epoch()
+{
+    size_t    columns = sample_counters.size();
+    uint32_t* row     = &sample_table[sample_count * columns];
+    for (size_t i = 0; i < columns; i++)
+    {
+        uint64_t value = read_value(sample_counters[i]);
+        uint64_t delta = value - sample_previous[i];
+        sample_previous[i] = value;
+        row[i] = (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t) delta;
+    }
+
+    if (++sample_count == sample_capacity)
+    {
+        for (size_t e = 0; e < sample_capacity / 2; e++)
+        {
+            for (size_t i = 0; i < columns; i++)
+            {
+                uint64_t sum = (uint64_t) sample_table[(2 * e) * columns + i] +
+                                          sample_table[(2 * e + 1) * columns + i];
+                sample_table[e * columns + i] = (sum > UINT32_MAX) ? UINT32_MAX : (uint32_t) sum;
+            }
+        }
+        sample_count   = sample_capacity / 2;
+        sample_length *= 2;
+    }
+}
+
+// Reads the sampling options and allocates the table
+static void configure_sampling()
+{
+    sample_configured = true;
+    metrics_next_sample_cycle  = UINT64_MAX;
+    metrics_next_sample_access = UINT64_MAX;
+
+    long long cycles   = option_int("sample-cycles", 0);
+    long long accesses = option_int("sample-accesses", 0);
+    if (cycles > 0 && accesses > 0)
+    {
+        throw runtime_error("Error, use either --sample-cycles or --sample-accesses");
+    }
+    if (cycles <= 0 && accesses <= 0)
+    {
+        return;
+    }
+
+    sample_by_access = (accesses > 0);
+    sample_length    = sample_by_access ? accesses : cycles;
+    sample_capacity  = option_int("sample-epochs", 65536);
+    if (sample_capacity < 2 || sample_capacity % 2 != 0)
+    {
+        // Merging pairs of epochs would drop the last one of an odd table
+        throw runtime_error("Error, --sample-epochs must be an even number of at least 2");
+    }
+
+    // All counters registered so far are sampled
+    sample_counters.clear();
+    for (size_t i = 0; i < metrics.size(); i++)
+    {
+        sample_counters.push_back(metrics[i].value);
+    }
+    sample_previous.assign(sample_counters.size(), 0);
+    sample_table.assign(sample_capacity * sample_counters.size(), 0);
+    sample_count = 0;
+
+    if (sample_by_access)
+    {
+        metrics_next_sample_access = sample_length;
+    }
+    else
+    {
+        metrics_next_sample_cycle = sample_length;
+    }
+}
+
+void metrics_sample(uint64_t now, bool accesses)
+{
+    if (!sample_configured)
+    {
+        configure_sampling();
+    }
+    if (sample_length == 0 || accesses != sample_by_access)
+    {
+        return;
+    }
+
+    // Epochs end at multiples of the epoch length; epochs without any
+    // call in between are recorded as epochs without growth
+    uint64_t& next = accesses ? metrics_next_sample_access : metrics_next_sample_cycle;
+    while (now >= next)
+    {
+        take_epoch();
+        next = (sample_count + 1) * sample_length;
+    }
+}
+
+// Writes the epoch table to the --sample-file, including the last epoch
+static void write_samples()
+{
+    if (sample_length == 0)
+    {
+        return;
+    }
+
+    // Record the epoch that was still running, unless it is empty
+    uint64_t end = (sample_by_access ? __atomic_load_n(&metrics_accesses, __ATOMIC_RELAXED) : metrics_now);
+    if (end > sample_count * sample_length)
+    {
+        take_epoch();
+    }
+
+    const char* filename = option_string("sample-file", "samples.csv");
+    size_t      len      = strlen(filename);
+    bool        binary   = (len >= 4 && !strcmp(filename + len - 4, ".bin"));
+    FILE*       f        = fopen(filename, binary ? "wb" : "w");
+    if (f == NULL)
+    {
+        throw runtime_error(string("Unable to open file: ") + filename);
+    }
+
+    // Counters are identified by their names
+    size_t columns = sample_counters.size();
+    vector<const string*> names(columns);
+    for (size_t i = 0; i < columns; i++)
+    {
+        for (size_t m = 0; m < metrics.size(); m++)
+        {
+            if (metrics[m].value == sample_counters[i])
+            {
+                names[i] = &metrics[m].name;
+                break;
+            }
+        }
+    }
+
+    if (binary)
+    {
+        uint32_t header[3] = { (uint32_t) columns, (uint32_t) sample_count, sample_by_access };
+        fwrite("EPOC", 1, 4, f);
+        fwrite(header, sizeof(uint32_t), 3, f);
+        fwrite(&sample_length, sizeof(uint64_t), 1, f);
+        fwrite(&end, sizeof(uint64_t), 1, f);
+        for (size_t i = 0; i < columns; i++)
+        {
+            uint16_t size = names[i]->size();
+            fwrite(&size, sizeof(size), 1, f);
+            fwrite(names[i]->data(), 1, size, f);
+        }
+        if (sample_count > 0)
+        {
+            fwrite(&sample_table[0], sizeof(uint32_t), sample_count * columns, f);
+        }
+    }
+    else
+    {
+        fprintf(f, "start,end");
+        for (size_t i = 0; i < columns; i++)
+        {
+            fprintf(f, ",%s", names[i]->c_str());
+        }
+        fprintf(f, "\n");
+
+        for (size_t e = 0; e < sample_count; e++)
+        {
+            uint64_t stop = (e + 1) * sample_length;
+            fprintf(f, "%llu,%llu", (unsigned long long) (e * sample_length),
+                    (unsigned long long) ((stop < end) ? stop : end));
+            for (size_t i = 0; i < columns; i++)
+            {
+                fprintf(f, ",%u", sample_table[e * columns + i]);
+            }
+            fprintf(f, "\n");
+        }
+    }
+
+    if (fclose(f) != 0)
+    {
+        throw runtime_error(string("Unable to write file: ") + filename);
+    }
+}
+
+// Writes the metrics into a file using the given function
+static void write_file(const char* filename, void (*write)(FILE*))
+{
+    FILE* f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        throw runtime_error(string("Unable to open file: ") + filename);
+    }
+    write(f);
+    fclose(f);
+}
+
+void metrics_export()
+{
+    const char* json = option_string("metrics-json", NULL);
+    const char* csv  = option_string("metrics-csv", NULL);
+    if (json != NULL)
+    {
+        write_file(json, metrics_write_json);
+    }
+    if (csv != NULL)
+    {
+        write_file(csv, metrics_write_csv);
+    }
+    if (interval_file != NULL)
+    {
+        fflush(interval_file);
+    }
+    write_samples();
+}
+
+void metrics_write_interval(uint64_t now)
+{
+    if (interval == 0)
+    {
+        // First call, find out if intervals were requested at all
+        interval = option_int("metrics-interval", 0);
+        if (interval == 0)
+        {
+            metrics_next_interval = UINT64_MAX;
+            return;
+        }
+
+        const char* filename = option_string("metrics-interval-file",
+                                             "metrics_intervals.jsonl");
+        interval_file = fopen(filename, "w");
+        if (interval_file == NULL)
+        {
+            throw runtime_error(string("Unable to open file: ") + filename);
+        }
+        metrics_next_interval = interval;
+        return;
+    }
+
+    fprintf(interval_file, "{\"cycle\":%llu,", (unsigned long long) now);
+    write_json_members(interval_file, "");
+    fprintf(interval_file, "}\n");
+
+    // Skip intervals in which no tick happened
+    metrics_next_interval = (now / interval + 1) * interval;
+}
+
+void metrics_reset()
+{
+    for (size_t i = 0; i < owned_counters.size(); i++)
+    {
+        owned_counters[i] = 0;
+    }
+    for (size_t i = 0; i < histograms.size(); i++)
+    {
+        metrics_histogram& h = histograms[i];
+        h.buckets.assign(h.buckets.size(), 0);
+        h.count = 0;
+        h.sum   = 0;
+        h.max   = 0;
+    }
+
+    // The next epoch holds the growth from now on
+    for (size_t i = 0; i < sample_counters.size(); i++)
+    {
+        sample_previous[i] = read_value(sample_counters[i]);
+    }
+}
+
+void metrics_cleanup()
+{
+    if (interval_file != NULL)
+    {
+        fclose(interval_file);
+        interval_file = NULL;
+    }
+    metrics.clear();
+    owned_counters.clear();
+    histograms.clear();
+    interval = 0;
+    metrics_next_interval = 0;
+
+    sample_configured = false;
+    sample_length     = 0;
+    sample_count      = 0;
+    sample_counters.clear();
+    sample_previous.clear();
+    sample_table.clear();
+    metrics_next_sample_cycle  = 0;
+    metrics_next_sample_access = 0;
+    metrics_accesses           = 0;
+    metrics_now                = 0;
+}
@@ -0,0 +1,102 @@
+/*
+// File: parallel.h
+//
+// Host threads for the private work of the simulated cores. The SystemC
+// kernel runs all processes on one host thread, but most of what a core
+// does (decoding its trace, hitting in its L1) does not involve the other
+// cores. A simulator lets a core run ahead through such work without
+// waiting for every cycle, and hands the run-ahead of all cores that are
+// ready at the same moment to ParallelRunner::run(), which runs them on a
+// pool of host threads and returns once all of them are done.
+//
+// A core runs ahead until its first access that needs the bus, or for at
+// most one quantum of cycles, after which it synchronises with the other
+// cores again. Accesses of other cores that fall in the same quantum are
+// seen after the run-ahead instead of in between, so the results differ
+// from a simulation without run-ahead by at most a quantum per access. The
+// work of a core only touches the state of that core, and the batches are
+// formed from simulated time only, so the results do not depend on the
+// number of threads or on how the host schedules them.
+//
+// The runner does not depend on SystemC. The following options are used
+// (see init_options in aca2009.h):
+//   --parallel-threads=<n>     Host threads including the simulation thread,
+//                              0 to simulate every cycle (default: 0)
+//   --parallel-quantum=<n>     Cycles a core may run ahead (default: 100)
+//
+// The batches are registered as the metrics (see metrics.h)
+// "parallel.batches", "parallel.cores" (run-aheads over all batches),
+// "parallel.cycles" (cycles run ahead) and the histogram
+// "parallel.batch_size" (run-aheads per batch).
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <vector>
+#include "metrics.h"
+
+// Runs the work of one core, given the pointer passed to ParallelRunner::run()
+typedef void (*parallel_work)(void* core);
+
+class ParallelRunner
+{
+public:
+    // Starts threads - 1 host threads, the thread that calls run() is the last one
+    ParallelRunner(unsigned int threads, unsigned int quantum);
+    ~ParallelRunner();
+
+    /*
+     * Calls work(cores[i]) for i = 0..count-1, spread over the threads, and
+     * returns when all calls have returned. Calls for different cores may run
+     * at the same time, so they may not touch any state they share.
+     */
+    void run(parallel_work work, void* const* cores, size_t count);
+
+    // Counts cycles that the cores ran ahead
+    void ran_ahead(uint64_t cycles) { *m_cycles += cycles; }
+
+    unsigned int threads() const { return (unsigned int) m_threads.size() + 1; }
+    unsigned int quantum() const { return m_quantum; }
+
+private:
+    static void* thread_main(void* arg);
+
+    // Runs the calls of the current batch that no thread has taken yet
+    void work();
+
+    // Not copyable
+    ParallelRunner(const ParallelRunner&);
+    ParallelRunner& operator=(const ParallelRunner&);
+
+    std::vector<pthread_t> m_threads;
+    unsigned int           m_quantum;
+    pthread_mutex_t        m_lock;
+    pthread_cond_t         m_start;     // a batch was started or the runner stops
+    pthread_cond_t         m_done;      // the last thread finished the batch
+    uint64_t               m_batch;     // number of the current batch
+    unsigned int           m_busy;      // threads still working on the batch
+    bool                   m_stop;
+
+    // The current batch
+    parallel_work          m_work;
+    void* const*           m_cores;
+    size_t                 m_count;
+    size_t                 m_next;      // next call to take, updated atomically
+
+    uint64_t*              m_batches;
+    uint64_t*              m_runs;
+    uint64_t*              m_cycles;
+    metrics_histogram*     m_batch_size;
+};
+
+/*
+ * Creates a runner from the --parallel-threads and --parallel-quantum
+ * options, or returns NULL when every cycle is to be simulated.
+ */
+ParallelRunner* parallel_create();
+
+#endif
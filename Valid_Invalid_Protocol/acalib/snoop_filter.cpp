@@ -0,0 +1,117 @@
+/*
+// File: snoop_filter.cpp
+//
+// Counting Bloom filter in front of the snoop port of a cache, see
+// snoop_filter.h
+*/
+
+#include <stdexcept>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include "snoop_filter.h"
+#include "aca2009.h"
+
+using namespace std;
+
+// Odd multipliers of the multiplicative hashes, the top bits of the product
+// are the index
+const uint32_t SnoopFilter::HASH_MULTIPLIERS[4] = { 0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f };
+
+// A counter at this value stays there
+static const uint8_t COUNTER_MAX = 255;
+
+static unsigned int log2_of(unsigned int value)
+{
+    unsigned int bits = 0;
+    while ((1u << bits) < value)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+SnoopFilter::SnoopFilter(const char* name, unsigned int counters, unsigned int hashes, unsigned int line_size)
+    : m_counters(counters, 0), m_hashes(hashes), m_offset_bits(log2_of(line_size)),
+      m_shift(32 - log2_of(counters))
+{
+    if (counters < 2 || (counters & (counters - 1)) != 0)
+    {
+        throw runtime_error("Error, a snoop filter needs a power of two of at least two counters");
+    }
+    if (hashes < 1 || hashes > 4)
+    {
+        throw runtime_error("Error, a snoop filter uses 1 to 4 hashes");
+    }
+
+    string prefix = string(name) + ".snoop_filter.";
+    m_snoops          = metrics_counter((prefix + "snoops").c_str(), "Snooped requests of other caches");
+    m_filtered        = metrics_counter((prefix + "filtered").c_str(), "Snoops answered without a tag lookup");
+    m_false_positives = metrics_counter((prefix + "false_positives").c_str(),
+                                        "Snoops that passed the filter and missed");
+}
+
+void SnoopFilter::insert(uint32_t addr)
+{
+    for (unsigned int i = 0; i < m_hashes; i++)
+    {
+        uint8_t& c = m_counters[index(addr, i)];
+        if (c < COUNTER_MAX)
+        {
+            c++;
+        }
+    }
+}
+
+void SnoopFilter::remove(uint32_t addr)
+{
+    for (unsigned int i = 0; i < m_hashes; i++)
+    {
+        uint8_t& c = m_counters[index(addr, i)];
+        if (c > 0 && c < COUNTER_MAX)
+        {
+            c--;
+        }
+    }
+}
+
+bool SnoopFilter::may_contain(uint32_t addr)
+{
+    (*m_snoops)++;
+    for (unsigned int i = 0; i < m_hashes; i++)
+    {
+        if (m_counters[index(addr, i)] == 0)
+        {
+            (*m_filtered)++;
+            return false;
+        }
+    }
+    return true;
+}
+
+void SnoopFilter::print() const
+{
+    printf("Snoop filter: %u counters, %u hashes, %llu snoops, %llu filtered (%.1f%%), "
+           "%llu false positives\n",
+           (unsigned int) m_counters.size(), m_hashes, (unsigned long long) *m_snoops,
+           (unsigned long long) *m_filtered,
+           *m_snoops ? 100.0 * (double) *m_filtered / (double) *m_snoops : 0.0,
+           (unsigned long long) *m_false_positives);
+}
+
+SnoopFilter* snoop_filter_create(const char* name, unsigned int lines, unsigned int line_size)
+{
+    string      prefix = string(name) + "-snoop-filter";
+    const char* type   = option_string(prefix.c_str(), "none");
+    if (strcmp(type, "none") == 0)
+    {
+        return NULL;
+    }
+    if (strcmp(type, "bloom") == 0)
+    {
+        unsigned int ratio  = (unsigned int) option_int((prefix + "-ratio").c_str(), 8);
+        unsigned int hashes = (unsigned int) option_int((prefix + "-hashes").c_str(), 2);
+        return new SnoopFilter(name, 1u << log2_of(lines * ratio), hashes, line_size);
+    }
+    throw runtime_error(string("Error, unknown snoop filter: ") + type);
+}
@@ -0,0 +1,94 @@
+/*
+// File: split_bus.h
+//
+// Timing of a split-transaction bus. A transaction has a request phase on
+// the address bus and a response phase on a separate data bus, and the
+// address bus is free for other requests in between. A request can only be
+// put on the bus while one of a fixed number of transaction slots is free;
+// the requester holds the address bus until one is, and the slot is held
+// until the response has arrived. A response is ready some cycles after its
+// request, depending on where it comes from (another cache, the L2, L3 or
+// memory), and then waits for the data bus, which carries one response at
+// a time. Responses are put on the data bus in the order in which they are
+// ready, not in the order of the requests, so a quick response overtakes a
+// slow one, as from a pipelined memory that serves all requests at once.
+//
+// The bus only keeps the cycles at which its slots and the data bus are
+// free. It does not depend on SystemC: the caller gives the current cycle
+// and waits for the cycles that issue() returns.
+//
+// The following options are used (see init_options in aca2009.h), with the
+// name given to split_bus_create() as prefix:
+//   --<name>-outstanding=<n>   Transaction slots (default: 8)
+//   --<name>-width=<bytes>     Bytes the data bus carries per cycle, a line
+//                              takes at least one cycle (default: 32)
+//
+// The following metrics are registered (see metrics.h), with the name as
+// prefix: "<name>.transactions", "<name>.slot_stalls",
+// "<name>.slot_stall_cycles", "<name>.data_wait_cycles" (cycles that ready
+// responses waited for the data bus), "<name>.reordered" (responses that
+// arrived before the response of an earlier request) and the histogram
+// "<name>.outstanding" of the slots in use when a request arrives.
+*/
+
+#ifndef SPLIT_BUS_H
+#define SPLIT_BUS_H
+
+#include <stdint.h>
+#include <vector>
+#include "metrics.h"
+
+class SplitBus
+{
+public:
+    // A bus with the given number of slots, a response takes data_cycles
+    SplitBus(const char* name, unsigned int outstanding, unsigned int data_cycles);
+
+    /*
+     * Puts a request on the bus at cycle now, whose response is ready
+     * latency cycles after the request. start is set to the cycle at which
+     * a slot was free, now unless all slots were in use. Returns the cycle
+     * at which the response has arrived.
+     */
+    uint64_t issue(uint64_t now, unsigned int latency, uint64_t& start);
+
+    unsigned int outstanding() const { return (unsigned int) m_slots.size(); }
+
+    // Pretty-prints the transactions, stalls and reordering
+    void print() const;
+
+private:
+    // Frees the slots whose responses have arrived by cycle now
+    void retire(uint64_t now);
+
+    // Reserves the data bus for a response that is ready at cycle ready,
+    // returns the cycle at which it has been carried
+    uint64_t reserve_data(uint64_t ready);
+
+    // Data bus reservation, from start up to end
+    struct transfer
+    {
+        uint64_t start;
+        uint64_t end;
+    };
+
+    std::vector<uint64_t> m_slots;      // cycle at which the response of each slot arrives
+    unsigned int          m_count;      // slots in use, the first m_count
+    unsigned int          m_data_cycles;
+    std::vector<transfer> m_transfers;  // reservations of the data bus, by start
+
+    uint64_t*             m_transactions;
+    uint64_t*             m_stalls;
+    uint64_t*             m_stall_cycles;
+    uint64_t*             m_data_wait;
+    uint64_t*             m_reordered;
+    metrics_histogram*    m_occupancy;
+};
+
+/*
+ * Creates a bus from the --<name>-outstanding and --<name>-width options,
+ * for a bus that carries lines of line_size bytes.
+ */
+SplitBus* split_bus_create(const char* name, unsigned int line_size);
+
+#endif
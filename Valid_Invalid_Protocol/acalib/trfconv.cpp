@@ -0,0 +1,172 @@
+/*
+// File: trfconv.cpp
+//
+// Converts a tracefile into the compact "3TRF" format, see aca2009.h for a
+// description of the layout. The traces of all processors are read through
+// the TraceFile class, so any readable tracefile can be converted.
+//
+// Usage: trfconv <input tracefile> <output tracefile> [entries per chunk]
+*/
+
+#include <stdexcept>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+#include "aca2009.h"
+
+using namespace std;
+
+static const uint32_t DEFAULT_CHUNK_ENTRIES = 4096;
+
+// Appends big-endian integers to a buffer
+static void put_be32(vector<uint8_t>& buf, uint32_t value)
+{
+    buf.push_back(value >> 24);
+    buf.push_back(value >> 16);
+    buf.push_back(value >> 8);
+    buf.push_back(value);
+}
+
+static void put_be64(vector<uint8_t>& buf, uint64_t value)
+{
+    put_be32(buf, (uint32_t) (value >> 32));
+    put_be32(buf, (uint32_t) value);
+}
+
+// Encodes one chunk of entries, the address deltas restart at every chunk
+static void encode_chunk(vector<uint8_t>& buf, const TraceFile::Entry* e, size_t n)
+{
+    uint32_t prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t word   = e[i].addr >> 2;
+        int32_t  delta  = (int32_t) (word - prev);
+        uint32_t zigzag = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+        uint64_t value  = ((uint64_t) zigzag << 2) | e[i].type;
+        prev = word;
+
+        while (value >= 0x80)
+        {
+            buf.push_back((uint8_t) (value | 0x80));
+            value >>= 7;
+        }
+        buf.push_back((uint8_t) value);
+    }
+}
+
+static void write_all(FILE* f, const vector<uint8_t>& buf)
+{
+    if (!buf.empty() && fwrite(&buf[0], 1, buf.size(), f) != buf.size())
+    {
+        throw runtime_error("Unable to write output file");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "Error, usage: " << argv[0]
+             << " <tracefile> <output tracefile> [entries per chunk]" << endl;
+        return 1;
+    }
+
+    uint32_t chunk_entries = DEFAULT_CHUNK_ENTRIES;
+    if (argc > 3)
+    {
+        chunk_entries = strtoul(argv[3], NULL, 0);
+        if (chunk_entries == 0)
+        {
+            cerr << "Error, entries per chunk must be positive" << endl;
+            return 1;
+        }
+    }
+
+    FILE* out = NULL;
+    try
+    {
+        TraceFile in(argv[1]);
+        uint32_t  procs = in.get_proc_count();
+
+        out = fopen(argv[2], "wb");
+        if (out == NULL)
+        {
+            throw runtime_error(string("Unable to open file: ") + argv[2]);
+        }
+
+        // Header, the directory is filled in once all chunks are written
+        vector<uint8_t> buf;
+        buf.insert(buf.end(), "3TRF", "3TRF" + 4);
+        put_be32(buf, procs);
+        put_be32(buf, chunk_entries);
+        put_be32(buf, 0);
+        buf.resize(TraceFile::V3_HEADER_SIZE + procs * TraceFile::V3_DIRECTORY_SIZE);
+        write_all(out, buf);
+        uint64_t offset = buf.size();
+
+        // Chunks of all processors, one processor after the other
+        vector<TraceFile::Entry> entries(chunk_entries);
+        vector<uint64_t>         counts(procs);
+        vector<vector<uint8_t> > tables(procs);
+        for (uint32_t pid = 0; pid < procs; pid++)
+        {
+            size_t n;
+            while ((n = in.next_batch(pid, &entries[0], chunk_entries)) > 0)
+            {
+                buf.clear();
+                encode_chunk(buf, &entries[0], n);
+                write_all(out, buf);
+
+                put_be64(tables[pid], offset);
+                put_be32(tables[pid], buf.size());
+                offset      += buf.size();
+                counts[pid] += n;
+            }
+        }
+
+        // Chunk tables, followed by the directory which points to them
+        vector<uint8_t> dir;
+        for (uint32_t pid = 0; pid < procs; pid++)
+        {
+            write_all(out, tables[pid]);
+            put_be64(dir, counts[pid]);
+            put_be64(dir, offset);
+            put_be32(dir, tables[pid].size() / TraceFile::V3_CHUNK_ENTRY_SIZE);
+            put_be32(dir, 0);
+            offset += tables[pid].size();
+        }
+
+        if (fseek(out, TraceFile::V3_HEADER_SIZE, SEEK_SET) != 0)
+        {
+            throw runtime_error("Unable to write output file");
+        }
+        write_all(out, dir);
+
+        if (fclose(out) != 0)
+        {
+            out = NULL;
+            throw runtime_error("Unable to write output file");
+        }
+        out = NULL;
+
+        uint64_t total = 0;
+        for (uint32_t pid = 0; pid < procs; pid++)
+        {
+            total += counts[pid];
+        }
+        printf("Converted %llu entries of %u processors, %llu bytes\n",
+               (unsigned long long) total, procs, (unsigned long long) offset);
+    }
+    catch (exception& e)
+    {
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
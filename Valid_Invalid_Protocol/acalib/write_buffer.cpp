@@ -0,0 +1,70 @@
+/*
+// File: write_buffer.cpp
+//
+// Timing of a write-back buffer, see write_buffer.h
+*/
+
+#include <string>
+#include <stdio.h>
+#include "write_buffer.h"
+
+using namespace std;
+
+WriteBuffer::WriteBuffer(const char* name, unsigned int entries, unsigned int drain_latency)
+    : m_done(entries), m_head(0), m_count(0), m_drain_latency(drain_latency), m_last_done(0)
+{
+    string prefix(name);
+    m_writebacks   = metrics_counter((prefix + ".writebacks").c_str(), "Dirty lines written back");
+    m_stalls       = metrics_counter((prefix + ".wbstalls").c_str(), "Write-backs into a full buffer");
+    m_stall_cycles = metrics_counter((prefix + ".wbstall_cycles").c_str(), "Cycles stalled on a full buffer");
+    m_occupancy    = metrics_histogram_create((prefix + ".wboccupancy").c_str(), 1, entries + 1,
+                                              "Lines in the write-back buffer");
+}
+
+void WriteBuffer::retire(uint64_t now)
+{
+    while (m_count > 0 && m_done[m_head] <= now)
+    {
+        m_head = (m_head + 1) % m_done.size();
+        m_count--;
+    }
+}
+
+unsigned int WriteBuffer::push(uint64_t now)
+{
+    (*m_writebacks)++;
+    if (m_done.empty())
+    {
+        // Without a buffer the line is written before the cache goes on
+        (*m_stalls)++;
+        *m_stall_cycles += m_drain_latency;
+        return m_drain_latency;
+    }
+
+    retire(now);
+    metrics_histogram_add(m_occupancy, m_count);
+
+    unsigned int stall = 0;
+    if (m_count == m_done.size())
+    {
+        stall = (unsigned int) (m_done[m_head] - now);
+        (*m_stalls)++;
+        *m_stall_cycles += stall;
+        retire(now + stall);
+    }
+
+    // Lines are written one at a time, after the ones before them
+    uint64_t start = (m_last_done > now + stall) ? m_last_done : now + stall;
+    m_last_done = start + m_drain_latency;
+    m_done[(m_head + m_count) % m_done.size()] = m_last_done;
+    m_count++;
+    return stall;
+}
+
+void WriteBuffer::print() const
+{
+    printf("Write-backs: %llu, buffer of %u stalled %llu times (%llu cycles), median occupancy %llu\n",
+           (unsigned long long) *m_writebacks, (unsigned int) m_done.size(),
+           (unsigned long long) *m_stalls, (unsigned long long) *m_stall_cycles,
+           (unsigned long long) metrics_histogram_percentile(m_occupancy, 0.5));
+}
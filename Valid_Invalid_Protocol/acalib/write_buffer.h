@@ -0,0 +1,63 @@
+/*
+// File: write_buffer.h
+//
+// Timing of a write-back buffer between a cache and the level below it.
+// Evicted dirty lines are put in the buffer and written to memory one after
+// the other in the background, each taking the drain latency. The cache only
+// stalls when it puts a line in a full buffer, until the oldest line has
+// been written. A buffer of 0 entries makes every write-back stall for the
+// drain latency.
+//
+// The buffer only keeps the times at which its lines are written, the data
+// goes to the backing store (see backing_store.h) right away. It does not
+// depend on SystemC: the caller gives the current cycle and waits for the
+// stall that push() returns.
+//
+// The following metrics are registered (see metrics.h), with the name given
+// to the constructor as prefix: "<name>.writebacks", "<name>.wbstalls",
+// "<name>.wbstall_cycles" and the histogram "<name>.wboccupancy" of the
+// number of lines in the buffer when a line is put in it.
+*/
+
+#ifndef WRITE_BUFFER_H
+#define WRITE_BUFFER_H
+
+#include <stdint.h>
+#include <vector>
+#include "metrics.h"
+
+class WriteBuffer
+{
+public:
+    WriteBuffer(const char* name, unsigned int entries, unsigned int drain_latency);
+
+    // Puts a line in the buffer at cycle now, and returns the number of
+    // cycles the cache stalls because the buffer is full
+    unsigned int push(uint64_t now);
+
+    // Counts a write-back that takes no simulated time, e.g. while
+    // fast-forwarding or on a back-invalidation
+    void count() { (*m_writebacks)++; }
+
+    unsigned int entries() const { return (unsigned int) m_done.size(); }
+
+    // Pretty-prints the write-backs, stalls and occupancy
+    void print() const;
+
+private:
+    // Removes the lines that are written by cycle now
+    void retire(uint64_t now);
+
+    std::vector<uint64_t> m_done;       // ring of cycles at which the lines are written
+    unsigned int          m_head;       // oldest line
+    unsigned int          m_count;      // lines in the buffer
+    unsigned int          m_drain_latency;
+    uint64_t              m_last_done;  // cycle at which the newest line is written
+
+    uint64_t*             m_writebacks;
+    uint64_t*             m_stalls;
+    uint64_t*             m_stall_cycles;
+    metrics_histogram*    m_occupancy;
+};
+
+#endif
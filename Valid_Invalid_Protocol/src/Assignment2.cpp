@@ -22,13 +22,18 @@
 */
 
 #include "aca2009.h"
+#include "metrics.h"
+#include "acalog.h"
 #include <systemc.h>
+#include "cache_model.h"
+#include "cache_hierarchy.h"
+#include "backing_store.h"
+#include "parallel.h"
+#include "split_bus.h"
+#include "arbiter.h"
+#include "snoop_filter.h"
 #include <iostream>
 
-#define TAG_CHECK 0xFFFFF000
-#define SET_CHECK 0x00000FE0
-#define OFF_CHECK 0x0000001F
-
 #define READ 0
 #define WRITE 1
 
@@ -37,29 +42,20 @@ using namespace std;
 long BusRead;
 long BusWrites;
 
-static const int MAX_CACHE_ENTRIES 	= 128;
-static const int MAX_CACHE_SIZE 	= 32768; 	//32KB
-static const int CACHE_LINE_SIZE 	= 32; 		//32 bytes
-static const int MAX_SET 			= 8;
-
-
-typedef struct 
-    { 
-	//cache fields - Data, Valid, tag
-        unsigned int c_data[8];
-        unsigned int c_valid:1;
-        unsigned int c_tag:20;
-    } cache_data;
-   
-typedef struct 
-    {
-        unsigned int lru:7;                     	// 7 bit representation
-        cache_data way[MAX_SET];        		// 8
+// Default geometry: 32KB, 8-way set-associative, 32 byte lines, tree pseudo-LRU,
+// see --l1-size, --l1-ways, --l1-line and --l1-policy
+static const unsigned int L1_SIZE = 32768;
+static const unsigned int L1_WAYS = 8;
+static const unsigned int L1_LINE = 32;
 
-    } cache_set;
+// Length of a clock cycle, the modules wait for time instead of clock edges
+// so that idle cycles are skipped
+static const sc_time CLOCK_PERIOD(1, SC_NS);
 
 //unsigned int Memory_addr[12];
 int max_cpus = 0;
+// CPUs that have not executed their whole trace yet
+int pending_processors;
 /* Bus interface, modified version from assignment. */
 class Bus_if : public virtual sc_interface 
 {
@@ -67,8 +63,7 @@ class Bus_if : public virtual sc_interface
         virtual bool read(int writer, int addr) = 0;
         virtual bool write(int writer, int addr, int data) = 0;
 		virtual bool writeX(int writer, int addr, int data) = 0;
-		virtual bool busLock() = 0;
-		virtual bool busUnlock() = 0;
+		virtual unsigned int response(int writer, unsigned int latency) = 0;
 };
 
 
@@ -105,7 +100,6 @@ SC_MODULE(Cache)
             VALID,
     	};
 
-    	sc_in<bool>     Port_CLK;
     	sc_in<Function> Port_Func;
     	sc_in<int>      Port_Addr;
     	sc_out<RetCode> Port_Done;
@@ -123,10 +117,13 @@ SC_MODULE(Cache)
     	/* Variables. */
     	int cache_id;
 		int snooping;
+		CacheHierarchy* hierarchy;	// caches below the L1, shared by all caches
+		BackingStore* store;		// contents of main memory
 
-    	void update_lru(int line, int way);
-    	int lru_call(int line);
-    	int cache_operation(int cache_id, int addr, int mode);
+    	int cache_operation(int cache_id, int addr, int mode, int value);
+    	size_t run_ahead(const TraceFile::Entry* entries, size_t count, unsigned int limit,
+    	                 unsigned int& cycles, stats_sample& stats);
+    	static bool back_invalidate(void* cache, uint32_t addr);
 
 
     	SC_CTOR(Cache) 
@@ -137,33 +134,25 @@ SC_MODULE(Cache)
             SC_THREAD(bus);
             SC_THREAD(execute);
 		
-            sensitive << Port_CLK.pos();
-            dont_initialize();
-		
-            m_data = new cache_set[MAX_CACHE_SIZE /( MAX_SET * CACHE_LINE_SIZE)];
-	    
-	    	//for (int k = 0; k< 160; k++)
-	    	//	Memory_Data[k] = 0; 	
-
-            for (int i = 0; i < MAX_CACHE_ENTRIES ; i++)
-            {
-                for (int j = 0; j < MAX_SET ; j++)
-            	{
-                    m_data[i].way[j].c_tag = 0xFFFFF;
-		    		m_data[i].way[j].c_valid = 0; // set cache line to invalid
-            	}
-            }	
+            // all cache lines start out invalid
+            m_cache = cache_create("l1", L1_SIZE, L1_WAYS, L1_LINE, INVALID);
+            m_snoop_filter = snoop_filter_create("l1", m_cache->sets() * m_cache->ways(), m_cache->line_size());
         }		
 
         ~Cache() 
         {
-            delete[] m_data;
+            delete m_snoop_filter;
+            delete m_cache;
         }
 
+        const SnoopFilter* get_snoop_filter() const { return m_snoop_filter; }
+
     private:
 
-    	cache_set* m_data;
+    	CacheArray* m_cache;
+    	SnoopFilter* m_snoop_filter;	// NULL when every snoop looks up the tags
     	int data;
+    	void evict(uint32_t set, int way);
     	/* Thread that handles the bus. */
     	int BusReads;
     	int BusWrites;
@@ -175,24 +164,22 @@ SC_MODULE(Cache)
             while(true)
             {
             	/* Wait for work. */
-				cout << "cache_id:"<< cache_id << " waiting for Port_BusValid to change" << endl;
+				LOG_TRACE(LOG_BUS, "cache_id:" << cache_id << " waiting for Port_BusValid to change");
             	wait(Port_BusValid.value_changed_event());
 	    		int snooper = Port_BusWriter.read();
 		
-				cout << "cache_id:" << cache_id << " - Port_BusValid changed" << endl;
+				LOG_TRACE(LOG_BUS, "cache_id:" << cache_id << " - Port_BusValid changed");
 				if (snooper != cache_id)
 				{ 
 	    			int addr = Port_BusAddr.read().to_int();
-	    			unsigned int tag = (addr & TAG_CHECK) >> 12;
-	    			unsigned int set = (addr & SET_CHECK) >> 5;
-	    			//unsigned int word = (addr & OFF_CHECK) >> 2;
+	    			uint32_t tag = m_cache->tag_of(addr);
+	    			uint32_t set = m_cache->set_of(addr);
 	
 	    			//Function req = Port_BusValid.read(); 
 	    			Bus_Req req = Port_BusValid.read(); 
 					//cout << "Port reading is done" << endl;
-	    			cout << "Cache id    :" << cache_id << endl;
-	    			cout << "Bus Request :" << req << endl;
-					cout << "Bus snooper :" << snooper <<endl;
+	    			LOG_DEBUG(LOG_COHERENCE, "Cache id: " << cache_id << ", Bus Request: " << req
+	    			          << ", Bus snooper: " << snooper);
             		/* Possibilities. */
             		switch(Port_BusValid.read())
             		{
@@ -203,7 +190,7 @@ SC_MODULE(Cache)
 		 				case BUS_RD:
 						{
 			    			//Does normal Read Hit or Miss
-			    			cout << "*** Executing BUS_RD command ***" << endl;
+			    			LOG_DEBUG(LOG_COHERENCE, "*** Executing BUS_RD command ***");
 			    			BusReads++;
 			    			break;
 						}
@@ -215,42 +202,50 @@ SC_MODULE(Cache)
 			     			//	update local cache
 			     			//  cache[i]->cache_id = i;
 			     			//	cache[i]->snooping = snooping;
-			     			cout << "*** Executing BUS_WR/BUS_RdX command ***" << endl;
+			     			LOG_DEBUG(LOG_COHERENCE, "*** Executing BUS_WR/BUS_RdX command ***");
 			     			if (snooper != cache_id)
 			     			{
-								cout << "Snooper is not same as cache id" <<endl;
-  			         			for (int i=0; i < MAX_SET; i++)
+								LOG_TRACE(LOG_COHERENCE, "Snooper is not same as cache id");
+								// Lines the filter rules out are not looked up
+								bool lookup = m_snoop_filter == NULL || m_snoop_filter->may_contain(addr);
+								bool found = false;
+  			         			for (unsigned int i=0; lookup && i < m_cache->ways(); i++)
 				 				{
-				     				if ( m_data[set].way[i].c_valid == 1 )
+				     				if ( m_cache->state(set, i) == VALID && m_cache->tag(set, i) == tag)
 				     				{
-				         				if ( m_data[set].way[i].c_tag == tag)
-					 					{
-					     					m_data[set].way[i].c_valid = 0;
-					 					}
+				         				m_cache->set_state(set, i, INVALID);
+				         				found = true;
 				      				}
 				  				}
+								if (m_snoop_filter != NULL)
+								{
+									if (found)
+									{
+										m_snoop_filter->remove(addr);
+									}
+									else if (lookup)
+									{
+										m_snoop_filter->false_positive();
+									}
+								}
 							}
 							BusWrites++;
 							break;
 						}
 						case BUS_INVALID:
 						{
-			    			cout << "----------------------------------------------------" << endl;
-			    			cout << "----   *** Invalid BUS command is observed ***  ----" << endl;
-			    			cout << "----------------------------------------------------" << endl;
+			    			// The bus went back to idle after a transaction
 			    			break;
 						}
 				
 						default:
 						{
-			    			cout << "--------------------------------------------------------" << endl;
-			    			cout << "----   *** Could not recognize the BUS Command ***  ----" << endl;
-			    			cout << "--------------------------------------------------------" << endl;
+			    			LOG_ERROR(LOG_BUS, "----   *** Could not recognize the BUS Command ***  ----");
 			    			break;
 						}
 				} //end of snooper case
 
-				wait();
+				wait(CLOCK_PERIOD);
 
 			}//end of switch
         }//end of while
@@ -272,7 +267,7 @@ SC_MODULE(Cache)
 			
             if (f == FUNC_WRITE) 
             {
-                cout << sc_time_stamp() << " Cache_id: " << cache_id <<" received write" << endl;
+                LOG_DEBUG(LOG_CACHE, sc_time_stamp() << " Cache_id: " << cache_id << " received write");
                 data = Port_Data.read().to_int();
             }
 
@@ -281,248 +276,209 @@ SC_MODULE(Cache)
 			
 	    	if (f == FUNC_READ) 
             {
-                cache_data = cache_operation(cache_id, addr, READ);
+                cache_data = cache_operation(cache_id, addr, READ, 0);
                 Port_Data.write( cache_data );
                 Port_Done.write( RET_READ_DONE );
-                wait();
+                wait(CLOCK_PERIOD);
                 Port_Data.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
             }
             else
             {
-                cache_data = cache_operation(cache_id, addr, WRITE);
-                cout << "Data " << data <<" is written at [ " << addr << " ]" << endl;
+                cache_data = cache_operation(cache_id, addr, WRITE, data);
+                LOG_DEBUG(LOG_CACHE, "Data " << data << " is written at [ " << addr << " ]");
                 Port_Done.write( RET_WRITE_DONE );
             }
         }//end of while
     }//end of execute
 };//end of cache
 		
-    int Cache::cache_operation(int cache_id, int addr, int mode)
+    int Cache::cache_operation(int cache_id, int addr, int mode, int value)
 	{
 	    //Check if the address is available in the cache by comparing the TAG
 	    // if tag match == HIT otherwise MISS
-	    int i = 0; 
 	    int ret_data = 0 ;
-	    int found = 0;
-	    unsigned int tag = (addr & TAG_CHECK) >> 12;
-	    unsigned int set = (addr & SET_CHECK) >> 5;
-	    unsigned int word = (addr & OFF_CHECK) >> 2;
+	    uint32_t set = m_cache->set_of(addr);
+	    uint32_t tag = m_cache->tag_of(addr);
+	    uint32_t word = m_cache->word_of(addr);
+	    int way = m_cache->find(set, tag);
 	    //int pid = 0;
-	    data = 0;
+	    data = value;
 	    if ( mode == 0 ) //READ
 	    {
 		//	READ MODE CHECK FOR TAG MATCH, IF TAG MATCHES THEN CHECK VALID.
 		//  IF VALID BLOCK IS FOUND, THEN RETURN THE VALUE OTHERWISE IT IS A READ MISS
-			for (i=0; i < MAX_SET; i++)
+			if (way >= 0 && m_cache->state(set, way) == VALID)
 			{
-		    	if ((m_data[set].way[i].c_tag == tag)  && (found == 0))
-		    	{
-					if ( m_data[set].way[i].c_valid == 1)
-					{
-			    		cout << "*** Read Hit - Valid Data is found ***" << endl;
-			    		cout << "*** No Bus command is required, since it is Read Hit PRd/-" << endl;
-		            	cout << " Read Hit on cache_id: " << cache_id << " at [ " << addr << " ]" <<endl;
-			    		stats_readhit(cache_id);
-			    		found = 1;
-			    		ret_data = m_data[set].way[i].c_data[word];
-			    		update_lru(set, i);
-			    		wait();
-			    		break;	
-					}
-					else
-					{
-			    		// READ MISS, COPY THE DATA FROM MAIN MEMORY
-			    		cout << " *** Read Miss - Data is not valid, copy data from Memory ***" << endl;
-			    		cout << " *** Read Miss - Issuing a BusRd, to copy the data from memory PRd/BusRd ***" << endl;
-		            	cout << " Read Miss on cache_id: " << cache_id << " at [ " << addr << " ]" << endl;
-			    		Port_Bus->read(cache_id, addr);
-		            	//cout << "I am back, cache_id : "<< cache_id << "Port_Bus->read is executed" << endl;
-			    		stats_readmiss(cache_id);
-			    		wait(100);
-		        		// wait(100); //write back the data to memory before updating the cache line
-		        		int selected_way = lru_call(set) ;	
-		    			m_data[set].way[selected_way].c_data[word] = rand();
-			    		m_data[set].way[selected_way].c_valid = 1;
-			    		m_data[set].way[selected_way].c_tag = tag;
-			    		ret_data = m_data[set].way[i].c_data[word];
-			    		found = 1;
-			    // update LRU
-			    update_lru(set, i);
-			    break;
+		        LOG_DEBUG(LOG_CACHE, " Read Hit on cache_id: " << cache_id << " at [ " << addr
+		                  << " ], no Bus command is required PRd/-");
+			    stats_readhit(cache_id);
+			    ret_data = m_cache->data(set, way)[word];
+			    m_cache->touch(set, way);
+			    wait(CLOCK_PERIOD);
+			    return ret_data;
+			}
+
+			if (way >= 0)
+			{
+			    // READ MISS, COPY THE DATA FROM MAIN MEMORY
+		        LOG_DEBUG(LOG_CACHE, " Read Miss on cache_id: " << cache_id << " at [ " << addr
+		                  << " ], Data is not valid, issuing a BusRd PRd/BusRd");
+			}
+			else
+			{
+			    //READ MISS, GET THE DATA FROM MEMORY AND FILL AN INVALID WAY OR THE POLICY'S VICTIM
+		        LOG_DEBUG(LOG_CACHE, " Read Miss on cache_id: " << cache_id << " at [ " << addr
+		                  << " ], Data is stale, issuing a BusRd PRd/BusRd");
 			}
-		     }
-		}
-		if (found == 0)
-		{
-		    //READ MISS, GET THE DATA FROM MEMORY AND REPLACE ONE LINE FROM CACHE USING LRU
-		    //GET THE WAY TO BE UPDATED THROUGH LRU
-		    cout << " *** Read Miss - Data is stale, Copy from memory ***" << endl;
-		    cout << " *** Read Miss - Issuing a BusRd, to copy the data from memory PRd/BusRd ***" << endl;
-		    cout << " Read Miss on cache_id: " << cache_id << " at [ " << addr << " ]" << endl;
 		    Port_Bus->read(cache_id, addr);
-		    //cout << "I am back, cache_id : "<< cache_id << "Port_Bus->read is executed" << endl;
 		    stats_readmiss(cache_id);
-		    //wait(100);
-		    wait(100); //write back the data to memory before updating the cache line
-		    int selected_way = lru_call(set) ;	
-		    m_data[set].way[selected_way].c_data[word] = rand();
-		    m_data[set].way[selected_way].c_valid = 1;
-		    m_data[set].way[selected_way].c_tag = tag;
-		    //update LRU table
-		    update_lru(set, selected_way);
-		    ret_data = m_data[set].way[selected_way].c_data[word];
-		    found = 1;		
-		}
+		    //fetch the line from the L2, L3 or memory, the bus is free meanwhile
+		    unsigned int cycles = Port_Bus->response(cache_id, hierarchy->miss(cache_id, addr));
+
+		    // The line is ours from the request on, so it is filled before
+		    // its data arrives: writes of other caches from now on invalidate
+		    // it. An invalidated copy of the line is refilled in place, so
+		    // that the set never holds the tag twice
+		    if (way < 0)
+		    {
+		        way = m_cache->victim(set);
+		        LOG_TRACE(LOG_CACHE, " Way Selected by " << m_cache->policy() << " is " << way);
+		        evict(set, way);
+		    }
+		    store->read_line(m_cache->addr_of(set, tag), m_cache->data(set, way), m_cache->line_size() / 4);
+		    // fill also updates the replacement state
+		    m_cache->fill(set, way, tag, VALID);
+		    if (m_snoop_filter != NULL)
+		    {
+		        m_snoop_filter->insert(addr);
+		    }
+		    ret_data = m_cache->data(set, way)[word];
+		    wait(CLOCK_PERIOD * cycles);
 	    return ret_data;	
 	    }		
 	    else
 	    // NEED TO PERFORM WRITE OPERATION
 	    {
-		
-		for (i=0; i < MAX_SET; i++)
+		unsigned int cycles;
+		if (way >= 0 && m_cache->state(set, way) == VALID)
 		{
-		    if ((m_data[set].way[i].c_tag == tag)  && (found == 0) && (m_data[set].way[i].c_valid == 1))
-		    {
-				cout << " *** Cache write Hit ***" << endl;
-				cout << " *** WriteHit - Issue bus command PrWR/BusWr *** " << endl;
-		        cout << " Write Hit on cache_id: " << cache_id << " at [ " << addr << " ]" << endl;
-				Port_Bus->write(cache_id, addr, data);
-		        //cout << "I am back, cache_id : "<< cache_id << "Port_Bus->Write is executed" << endl;
-				Port_Bus->busLock();
-				m_data[set].way[i].c_data[word] = data;
-				stats_writehit(cache_id);
-				m_data[set].way[i].c_valid = 1;
-				//update LRU
-				update_lru(set, i);
-				found = 1;
-				ret_data = m_data[set].way[i].c_data[word];
-				wait();
-				break ;
-		    }
+		    LOG_DEBUG(LOG_CACHE, " Write Hit on cache_id: " << cache_id << " at [ " << addr
+		              << " ], issuing a BusWr PrWr/BusWr");
+		    Port_Bus->write(cache_id, addr, data);
+		    // The write goes through to memory, the bus is free meanwhile
+		    cycles = Port_Bus->response(cache_id, hierarchy->memory_latency());
+		    m_cache->data(set, way)[word] = data;
+		    stats_writehit(cache_id);
+		    //update replacement state
+		    m_cache->touch(set, way);
+		    wait(CLOCK_PERIOD);
 		}
-		if (found == 0)
+		else
 		{
-		    //WRITE MISS, HENCE GET A BLOCK ADDRESS THROUGH LRU LOOK UP TABLE
-		    cout << " *** Cache Write Miss " << endl;
-		    cout << " *** Write Miss - Issue Bus Command PrWr/BusRdX ***" << endl;
-		    cout << " Write Miss on cache_id: " << cache_id << " at [ " << addr << " ]" << endl;
+		    //WRITE MISS, HENCE GET A BLOCK ADDRESS FROM THE REPLACEMENT POLICY
+		    LOG_DEBUG(LOG_CACHE, " Write Miss on cache_id: " << cache_id << " at [ " << addr
+		              << " ], issuing a BusRdX PrWr/BusRdX");
 		    //Implement BusRdX prototcol - CHECK
 		    Port_Bus->writeX(cache_id, addr, data); 
-		    //cout << "I am back, cache_id : "<< cache_id << "Port_Bus->WriteX is executed" << endl;
 		    stats_writemiss(cache_id);
-		    Port_Bus->busLock();
-		    //Valid Invalid Protocol Assumes Write Through Protocol
-		    wait(100);
-
-		    int selected_way = lru_call(set);
-		    cout << " Way Selected by LRU Look Up Table is " << selected_way <<endl;
-		    m_data[set].way[selected_way].c_data[word] = rand();
-		    m_data[set].way[selected_way].c_valid = 1;
-		    m_data[set].way[selected_way].c_tag = tag;
-		    //update LRU LUT
-		    update_lru(set, selected_way);
-		    //found = 1;	
+		    //Valid Invalid Protocol Assumes Write Through Protocol: the line
+		    //is fetched and the write goes through to memory in one transaction
+		    cycles = Port_Bus->response(cache_id, hierarchy->miss(cache_id, addr) + hierarchy->memory_latency());
+
+		    if (way < 0)
+		    {
+		        way = m_cache->victim(set);
+		        LOG_TRACE(LOG_CACHE, " Way Selected by " << m_cache->policy() << " is " << way);
+		        evict(set, way);
+		    }
+		    store->read_line(m_cache->addr_of(set, tag), m_cache->data(set, way), m_cache->line_size() / 4);
+		    m_cache->fill(set, way, tag, VALID);
+		    if (m_snoop_filter != NULL)
+		    {
+		        m_snoop_filter->insert(addr);
+		    }
+		    m_cache->data(set, way)[word] = data;
 		}
-		cout << "Write Through is Assumed, hence writing the data back to memory" << endl;
-		wait(100);	
-		Port_Bus->busUnlock();
+		LOG_TRACE(LOG_CACHE, "Write Through is Assumed, hence writing the data back to memory");
+		store->write_word(addr, data);
+		wait(CLOCK_PERIOD * cycles);
 		return 0;
 	    }	
 
     }  // END OF cache_operation();
-	
-    int Cache::lru_call(int line) 
-    {
-    	int present_state = m_data[line].lru;
-    	cout << "Present State for line "<< line << "is : " << present_state <<endl; 
-    	if( (present_state & 0xB ) == 0)
-    	{
-            return 0;
-    	} 
-		else if( (present_state & 0xB ) == 0x8 ) 
-    	{
-            return 1;
-    	} 
-		else if ( (present_state & 0x13 ) == 0x2 )
-    	{
-            return 2;
-		} 
-		else if ( (present_state & 0x13 ) == 0x12 )
-    	{
-            return 3;
-    	} 
-		else if ( (present_state & 0x25 ) == 0x1 )
-    	{
-            return 4;
-    	} 
-		else if ( (present_state & 0x25 ) == 0x21 ) 
-    	{
-            return 5;
-    	}
-		else if ( (present_state & 0x45 ) == 0x5 )
-    	{
-            return 6;
-		} 
-		else if ( (present_state & 0x45 ) == 0x45 )
-    	{
-            return 7;
-    	}
-    	else 
-		{
-            cout << "Something wrong in finding LRU Way :( "<< endl;
-            return 0;  
-    	}
-
-		
-    } //end of Cache::lru
 
-    void Cache::update_lru(int line, int way)
-    {
-		cout << " LRU way is: " << way << " and present LRU is " << m_data[line].lru << endl; 
-        if ( way == 0 ) //NS  xxx1x11
-		{
-            m_data[line].lru = m_data[line].lru | 0xB;
-        }
-        else if ( way == 1 )
-		{ // L1 is replaced. Next state xxx0x11
-            m_data[line].lru = m_data[line].lru | 0x3;
-            m_data[line].lru = m_data[line].lru & 0x77; 
-        }
-        else if ( way == 2 )
-		{ // NS xx1xx01
-            m_data[line].lru = m_data[line].lru | 0x11; 
-            m_data[line].lru = m_data[line].lru & 0x7D; 
-        }
-		else if ( way == 3 )
-        { // NS  xx0xx01
-            m_data[line].lru = m_data[line].lru | 0x1;
-            m_data[line].lru = m_data[line].lru & 0x6D;
-        }
-        else if( way ==4) 
-		{// NS x1xx1x0
-            m_data[line].lru = m_data[line].lru | 0x24; 
-            m_data[line].lru = m_data[line].lru & 0x7E; 
-        }
-        else if ( way == 5 ) // NS x0xx1x0
-        {      
-	    	m_data[line].lru = m_data[line].lru | 0x4; 
-            m_data[line].lru = m_data[line].lru & 0x5E; 
-        }
-        else if ( way == 6 )
-		{ // NS 1xxx0x0
-            m_data[line].lru = m_data[line].lru | 0x40; 
-            m_data[line].lru = m_data[line].lru & 0x7A; 
-        }
-        else if ( way ==7 ) 
-		{ // NS 0xxx0x0    
-            m_data[line].lru = m_data[line].lru & 0x3A;    
-        } 
-        else
-            cout << "Something wrong with LRU update"<< endl;
-
-		cout << " LRU way is: " << way << " and LRU is updated to " << m_data[line].lru << endl; 
-
-    } //end of Cache::update_lru
+    // Hands a valid line that is about to be replaced to the levels below the
+    // L1, lines are never dirty as every write is written through to memory
+    void Cache::evict(uint32_t set, int way)
+	{
+	    if (m_cache->state(set, way) == VALID)
+	    {
+	        hierarchy->evict(cache_id, m_cache->addr_of(set, m_cache->tag(set, way)));
+	        if (m_snoop_filter != NULL)
+	        {
+	            m_snoop_filter->remove(m_cache->addr_of(set, m_cache->tag(set, way)));
+	        }
+	    }
+	}
+
+    // Executes the entries up to the first one that needs the bus, for at
+    // most limit cycles: NOPs and read hits, every write goes to the bus.
+    // They take the cycles they take through the ports. Runs on a host
+    // thread (see Parallel_Sync), so it only touches this cache, and does
+    // not log. Returns the number of entries executed.
+    size_t Cache::run_ahead(const TraceFile::Entry* entries, size_t count, unsigned int limit,
+                            unsigned int& cycles, stats_sample& stats)
+	{
+	    size_t i;
+	    cycles = 0;
+	    for (i = 0; i < count; i++)
+	    {
+	        const TraceFile::Entry& e = entries[i];
+	        if (e.type == TraceFile::ENTRY_TYPE_NOP)
+	        {
+	            if (cycles + 1 > limit)
+	            {
+	                break;
+	            }
+	            cycles += 1;
+	            continue;
+	        }
+
+	        // A read takes a cycle in the cache and one in the CPU
+	        if (e.type != TraceFile::ENTRY_TYPE_READ || cycles + 2 > limit)
+	        {
+	            break;
+	        }
+	        int way = m_cache->lookup(e.addr);
+	        if (way < 0)
+	        {
+	            break;
+	        }
+	        m_cache->touch(m_cache->set_of(e.addr), way);
+	        stats.readhit++;
+	        cycles += 2;
+	    }
+	    return i;
+	}
+
+    // Removes a line from the L1 when an inclusive L2 or L3 evicts it
+    bool Cache::back_invalidate(void* cache, uint32_t addr)
+	{
+	    Cache* self = (Cache*) cache;
+	    CacheArray* l1 = self->m_cache;
+	    int way = l1->lookup(addr);
+	    if (way < 0)
+	    {
+	        return false;
+	    }
+	    l1->set_state(l1->set_of(addr), way, INVALID);
+	    if (self->m_snoop_filter != NULL)
+	    {
+	        self->m_snoop_filter->remove(addr);
+	    }
+	    return true;
+	}
+	
 
 	
 /* Bus class, provides a way to share one memory in multiple CPU + Caches. */
@@ -532,29 +488,34 @@ class Bus : public Bus_if, public sc_module
 public:
 
     /* Ports and  vb Signals. */
-    sc_in<bool> Port_CLK;
     //sc_out<Cache::Function> Port_BusValid;
     sc_out<Cache::Bus_Req> Port_BusValid;
     sc_out<int> Port_BusWriter;
 
     sc_signal_rv<32> Port_BusAddr;
 
-    /* Bus mutex. */
-    sc_mutex bus;
+    /* Arbitration of the address bus, see arbiter.h. */
+    BusArbiter* arbiter;
+    int         owner;      // cache that holds the bus, -1 when it is free
+    sc_event    arbitrate;  // a cache requested or released the bus
+    sc_event*   granted;    // per cache, the bus was granted to it
 
     /* Variables. */
 
-    int waits;
-    int reads;
-    int writes;
+    uint64_t waits;
+    uint64_t reads;
+    uint64_t writes;
+
+    /* Cycles waited per bus acquisition. */
+    metrics_histogram* acquire_cycles;
+
+    /* Transaction slots and data bus. */
+    SplitBus* split;
 
 public:
     /* Constructor. */
     SC_CTOR(Bus) 
     {
-        /* Handle Port_CLK to simulate delay */
-        sensitive << Port_CLK.pos();
-
         // Initialize some bus properties
         Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
 
@@ -563,18 +524,72 @@ public:
         reads = 0;
         writes = 0;
 
+        metrics_register("bus.waits", &waits, "Cycles spent waiting for the bus");
+        metrics_register("bus.reads", &reads, "BusRd transactions");
+        metrics_register("bus.writes", &writes, "BusWr and BusRdX transactions");
+        acquire_cycles = metrics_histogram_create("bus.acquire_cycles", 1, 256,
+                                                  "Cycles waited per bus acquisition");
+        split = split_bus_create("bus", (unsigned int) option_int("l1-line", L1_LINE));
+
+        arbiter = arbiter_create("bus", num_cpus);
+        owner   = -1;
+        granted = new sc_event[num_cpus];
+        SC_METHOD(arbitration);
+        sensitive << arbitrate;
+        dont_initialize();
+
     }//end of SC_CTOR
 
+    ~Bus()
+    {
+        delete[] granted;
+        delete arbiter;
+        delete split;
+    }
+
+    /* Get exclusive access to the bus, sleeping until the arbiter grants it to writer. */
+    void lock_bus(int writer)
+    {
+        sc_time start = sc_time_stamp();
+        arbiter->request(writer, (uint64_t) (start / CLOCK_PERIOD));
+        arbitrate.notify(SC_ZERO_TIME);
+        while (owner != writer)
+        {
+            wait(granted[writer]);
+        }
+        uint64_t cycles = (uint64_t) ((sc_time_stamp() - start) / CLOCK_PERIOD);
+        waits += cycles;
+        metrics_histogram_add(acquire_cycles, cycles);
+    }
+
+    /* Frees the bus for the next grant. */
+    void release_bus()
+    {
+        owner = -1;
+        arbitrate.notify(SC_ZERO_TIME);
+    }
+
+    /* Grants the free bus to a waiting cache. Runs in the delta cycle after
+       a request or a release, so that all requests made at the same time
+       compete. */
+    void arbitration()
+    {
+        if (owner >= 0)
+        {
+            return;
+        }
+        owner = arbiter->grant((uint64_t) (sc_time_stamp() / CLOCK_PERIOD));
+        if (owner >= 0)
+        {
+            granted[owner].notify();
+        }
+    }
+
     /* Perform a read access to memory addr for CPU #writer. */
     virtual bool read(int writer, int addr)
     {
         /* Try to get exclusive lock on bus. */
-        while(bus.trylock() == -1)
-		{
-            /* Wait when bus is in contention. */
-            waits++;
-            wait();
-        }
+        lock_bus(writer);
 
         /* Update number of bus accesses. */
         reads++;
@@ -585,30 +600,32 @@ public:
         Port_BusValid.write(Cache::BUS_RD);
 
         /* Wait for everyone to recieve. */
-        wait();
+        wait(CLOCK_PERIOD);
 
-        /* Reset. */
+        /* Reset, the bus stays locked until the response phase. */
         Port_BusValid.write(Cache::BUS_INVALID);
         Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
-        bus.unlock();
 
         return true;
     }
 
-    virtual bool busLock()
-    {
-		while(bus.trylock() == -1)
-		{
-	    	waits++;
-	    	wait();
-		}
-		return true;
-    }
-
-    virtual bool busUnlock()
+    /* Response phase of the request writer has on the bus: waits, holding
+       the address bus, until a transaction slot is free, then releases it.
+       The response is ready latency cycles later and then needs the data
+       bus. Returns the cycles from now until it has arrived. */
+    virtual unsigned int response(int writer, unsigned int latency)
     {
-		bus.unlock();
-		return true;
+        uint64_t now = (uint64_t) (sc_time_stamp() / CLOCK_PERIOD);
+        uint64_t start;
+        uint64_t done = split->issue(now, latency, start);
+        if (start > now)
+        {
+            LOG_DEBUG(LOG_BUS, sc_time_stamp() << " cache_id: " << writer << " waits " << (start - now)
+                      << " cycles for a transaction slot");
+            wait(CLOCK_PERIOD * (start - now));
+        }
+        release_bus();
+        return (unsigned int) (done - start);
     }
 
 
@@ -616,11 +633,7 @@ public:
     virtual bool write(int writer, int addr, int data)
     {
         /* Try to get exclusive lock on the bus. */
-        while(bus.trylock() == -1)
-		{
-            waits++;
-            wait();
-        }
+        lock_bus(writer);
 
         /* Update number of accesses. */
         writes++;
@@ -631,24 +644,19 @@ public:
         Port_BusValid.write(Cache::BUS_WR);
 
         /* Wait for everyone to recieve. */
-        wait();
+        wait(CLOCK_PERIOD);
 
-        /* Reset. */
+        /* Reset, the bus stays locked until the response phase. */
         Port_BusValid.write(Cache::BUS_INVALID);
         Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
-        bus.unlock();
 
         return true;
     }
 	
     virtual bool writeX(int writer, int addr, int data) 
     {
-    /* Try to get exclusive lock on the bus. */
-    	while(bus.trylock() == -1)
-		{
-	    	waits++;
-	    	wait();
-		}
+    	/* Try to get exclusive lock on the bus. */
+    	lock_bus(writer);
 		
 		/* Update number of accesses. */
 		writes++;
@@ -658,12 +666,11 @@ public:
 		Port_BusWriter.write(writer);
 
 		/* Wait for everyone to recieve. */
-		wait();
+		wait(CLOCK_PERIOD);
 		
-		/* Reset. */
+		/* Reset, the bus stays locked until the response phase. */
         Port_BusValid.write(Cache::BUS_INVALID);
         Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
-        bus.unlock();
 
 	return true;
     }
@@ -675,11 +682,14 @@ public:
         /* Write output as specified in the assignment. */
         double avg = (double)waits / double(reads + writes);
         printf("\n 2. Main memory access rates\n");
-        printf("    Bus had %d reads and %d writes.\n", reads, writes);
-        printf("    A total of %d accesses.\n", reads + writes);
+        printf("    Bus had %llu reads and %llu writes.\n",
+               (unsigned long long) reads, (unsigned long long) writes);
+        printf("    A total of %llu accesses.\n", (unsigned long long) (reads + writes));
         printf("\n 3. Average time for bus acquisition\n");
-        printf("    There were %d waits for the bus.\n", waits);
+        printf("    There were %llu waits for the bus.\n", (unsigned long long) waits);
         printf("    Average waiting time per access: %f cycles.\n", avg);
+        split->print();
+        arbiter->print();
         //printf("\n 4. Total execution time is %d", sc_time_stamp().to_int());
         //printf("\n");
     }
@@ -688,17 +698,46 @@ public:
 		
 
 	
+class CPU;
+
+// Runs the CPUs ahead on host threads (see parallel.h and --parallel-threads).
+// The CPUs that ask to run ahead in the same delta cycle form one batch, so
+// the batches only depend on simulated time.
+SC_MODULE(Parallel_Sync)
+{
+public:
+    ParallelRunner* runner;
+
+    SC_CTOR(Parallel_Sync)
+    {
+        SC_THREAD(execute);
+        runner = NULL;
+    }
+
+    // Runs cpu ahead in the next batch, returns when it has run
+    void run(CPU* cpu);
+
+private:
+    vector<CPU*>  pending;  // CPUs waiting for the next batch
+    vector<void*> batch;
+    sc_event      request;
+    sc_event      done;
+
+    void execute();
+};
+
 SC_MODULE(CPU) 
 {
 
 public:
-    sc_in<bool>                	Port_CLK;
     sc_in<Cache::RetCode>   	Port_MemDone;
     sc_out<Cache::Function> 	Port_MemFunc;
     sc_out<int>                	Port_MemAddr;
     sc_inout_rv<32>            	Port_MemData;
 	
 	int cpu_id;
+	Cache* cache;			// L1 of this CPU, only used to run ahead
+	Parallel_Sync* sync;	// NULL when every cycle is simulated
 	
 	//Bus Address declaration
 	//sc_inout_rv<32>				Port_MemBusAddr;
@@ -706,11 +745,65 @@ public:
     SC_CTOR(CPU) 
     {
         SC_THREAD(execute);
-        sensitive << Port_CLK.pos();
-        dont_initialize();
+        cache = NULL;
+        sync  = NULL;
+        head  = 0;
+        ended = false;
     }
 
+    static void run_ahead(void* cpu);
+
 private:
+    friend class Parallel_Sync;
+
+    // Entries read per refill of the trace buffer when running ahead
+    static const size_t TRACE_BATCH = 4096;
+
+    // Run-ahead state, see Parallel_Sync. The trace is read in batches as
+    // TraceFile is not thread-safe.
+    vector<TraceFile::Entry> entries;
+    size_t       head;
+    bool         ended;         // entries holds the end of the trace
+    unsigned int ahead_cycles;
+    stats_sample ahead_stats;
+    bool         ran;
+
+    void refill()
+    {
+        entries.resize(TRACE_BATCH);
+        entries.resize(tracefile_ptr->next_batch(cpu_id, &entries[0], TRACE_BATCH));
+        head  = 0;
+        ended = entries.size() < TRACE_BATCH;
+    }
+
+    // Whether the trace has entries left, read or not
+    bool more() const
+    {
+        return head < entries.size() || !tracefile_ptr->eof();
+    }
+
+    // Reads the next entry of the trace, NOPs after the end of the trace
+    // like TraceFile::next()
+    bool next(TraceFile::Entry& e)
+    {
+        if (sync == NULL)
+        {
+            return tracefile_ptr->next(cpu_id, e);
+        }
+        if (head == entries.size())
+        {
+            refill();
+        }
+        if (head == entries.size())
+        {
+            e.type = TraceFile::ENTRY_TYPE_NOP;
+            e.addr = 0;
+            return true;
+        }
+        e = entries[head++];
+        return true;
+    }
+
     void execute() 
     {
         TraceFile::Entry    tr_data;
@@ -719,10 +812,26 @@ private:
         int addr, data;
 		
         // Loop until end of tracefile
-        while(!tracefile_ptr->eof())
+        while(more())
         {
+            if (sync != NULL)
+            {
+                // Run ahead through the reads that hit in the L1, then do the
+                // next access through the ports
+                sync->run(this);
+                if (ahead_cycles > 0)
+                {
+                    wait(CLOCK_PERIOD * ahead_cycles);
+                    metrics_tick(sc_time_stamp().value() / 1000);
+                }
+                if (!more())
+                {
+                    break;
+                }
+            }
+
             // Get the next action for the processor in the trace
-            if(!tracefile_ptr->next(cpu_id, tr_data))
+            if(!next(tr_data))
             {
                 cerr << "Error reading trace for CPU" << endl;
                 break;
@@ -759,38 +868,103 @@ private:
 
                 if (f == Cache::FUNC_WRITE) 
                 {
-                    cout << sc_time_stamp() << ": CPU_" << cpu_id << " sends write" << endl;
+                    LOG_DEBUG(LOG_CPU, sc_time_stamp() << ": CPU_" << cpu_id << " sends write");
 
                     data = rand();
                     Port_MemData.write(data);
-                    wait();
+                    wait(CLOCK_PERIOD);
                     Port_MemData.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
                 }
                 else
                 {
-                    cout << sc_time_stamp() << ": CPU_" << cpu_id << " sends read" << endl;
+                    LOG_DEBUG(LOG_CPU, sc_time_stamp() << ": CPU_" << cpu_id << " sends read");
                 }
 
                 wait(Port_MemDone.value_changed_event());
 
                if (f == Cache::FUNC_READ)
                 {
-                    cout << sc_time_stamp() << ": CPU reads: " << Port_MemData.read() << endl;
+                    LOG_DEBUG(LOG_CPU, sc_time_stamp() << ": CPU_" << cpu_id << " reads: " << Port_MemData.read());
                 }
             }
-       /*     else
+            else
             {
-                cout << sc_time_stamp() << ": CPU_" << cpu_id << " executes NOP" << endl;
+                LOG_TRACE(LOG_CPU, sc_time_stamp() << ": CPU_" << cpu_id << " executes NOP");
             }
-         */   // Advance one cycle in simulated time            
-            wait();
+            // Advance one cycle in simulated time
+            wait(CLOCK_PERIOD);
+            metrics_tick(sc_time_stamp().value() / 1000);
         }
         
-        // Finished the Tracefile, now stop the simulation
-        sc_stop();
+        // Finished the Tracefile, stop the simulation once all CPUs have:
+        // the trace can end while other CPUs still have entries buffered
+        if (--pending_processors == 0)
+        {
+            sc_stop();
+        }
     }
 };
 
+// Runs on a host thread, see Parallel_Sync
+void CPU::run_ahead(void* arg)
+{
+    CPU* cpu = (CPU*) arg;
+    unsigned int quantum = cpu->sync->runner->quantum();
+
+    memset(&cpu->ahead_stats, 0, sizeof(cpu->ahead_stats));
+    cpu->head += cpu->cache->run_ahead(cpu->entries.data() + cpu->head, cpu->entries.size() - cpu->head,
+                                       quantum, cpu->ahead_cycles, cpu->ahead_stats);
+
+    // A CPU whose trace has ended idles until all traces have ended
+    if (cpu->head == cpu->entries.size() && cpu->ended && !tracefile_ptr->eof())
+    {
+        cpu->ahead_cycles = quantum;
+    }
+}
+
+void Parallel_Sync::run(CPU* cpu)
+{
+    cpu->ran = false;
+    pending.push_back(cpu);
+    request.notify(SC_ZERO_TIME);
+    while (!cpu->ran)
+    {
+        wait(done);
+    }
+}
+
+void Parallel_Sync::execute()
+{
+    while (true)
+    {
+        wait(request);
+
+        batch.assign(pending.begin(), pending.end());
+        pending.clear();
+
+        // The trace is read on the simulation thread
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            CPU* cpu = (CPU*) batch[i];
+            if (cpu->head == cpu->entries.size() && !cpu->ended)
+            {
+                cpu->refill();
+            }
+        }
+
+        runner->run(CPU::run_ahead, &batch[0], batch.size());
+
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            CPU* cpu = (CPU*) batch[i];
+            stats_merge(cpu->cpu_id, cpu->ahead_stats);
+            runner->ran_ahead(cpu->ahead_cycles);
+            cpu->ran = true;
+        }
+        done.notify(SC_ZERO_TIME);
+    }
+}
+
 
 int sc_main(int argc, char* argv[])
 {
@@ -799,6 +973,8 @@ int sc_main(int argc, char* argv[])
         // Get the tracefile argument and create Tracefile object
         // This function sets tracefile_ptr and num_cpus
         init_tracefile(&argc, &argv);
+        init_options(argc, argv);
+        log_init();
 
         //max_cpus = num_cpus;
 		
@@ -808,15 +984,25 @@ int sc_main(int argc, char* argv[])
 		
         // Initialize statistics counters
         stats_init();
-		
-		// The clock that will drive the CPU and Memory
-        sc_clock clk("clk", sc_time(1, SC_NS));
+        pending_processors = num_cpus;
+
+		// Caches below the L1, with the line size of the L1 caches
+		CacheHierarchy hierarchy(num_cpus, (unsigned int) option_int("l1-line", L1_LINE));
 
+		// Contents of main memory
+		BackingStore store;
+		
 		// Instantiate Module for Bus
 		Bus bus("bus");
-		
-		//Connect to Bus
-		bus.Port_CLK(clk);
+
+		// Host threads to run the CPUs ahead, NULL unless --parallel-threads is given
+		ParallelRunner* runner = parallel_create();
+		Parallel_Sync* parallel_sync = NULL;
+		if (runner != NULL)
+		{
+		    parallel_sync = new Parallel_Sync("parallel_sync");
+		    parallel_sync->runner = runner;
+		}
 
         /* Cpu and Cache pointers. */
         Cache* cache[num_cpus];
@@ -854,8 +1040,14 @@ int sc_main(int argc, char* argv[])
 
             /* Set ID's. */
             cpu[i]->cpu_id = i;
+            cpu[i]->cache = cache[i];
+            cpu[i]->sync = parallel_sync;
             cache[i]->cache_id = i;
             cache[i]->snooping = snooping;
+
+            cache[i]->hierarchy = &hierarchy;
+            cache[i]->store = &store;
+            hierarchy.attach(i, Cache::back_invalidate, cache[i]);
 			
 	    	/* Cache to Bus. */
             cache[i]->Port_BusAddr(bus.Port_BusAddr);
@@ -874,14 +1066,10 @@ int sc_main(int argc, char* argv[])
 	    	cpu[i]->Port_MemData(sigMemData[i]);
 	    	cpu[i]->Port_MemDone(sigMemDone[i]);
 			
-	    	cache[i]->Port_CLK(clk);
-	    	cpu[i]->Port_CLK(clk);
-			
 		}
 
         sc_trace_file *wf = sc_create_vcd_trace_file("Valid_Invalid_Protocol");
         // Dump the desired signals
-        sc_trace(wf, clk, "clock");
 		for (unsigned int k = 0; k < num_cpus; k++)
 		{
 	    	char cpu_addr[12];
@@ -910,13 +1098,22 @@ int sc_main(int argc, char* argv[])
 		sc_report_handler::set_actions(SC_ID_MORE_THAN_ONE_SIGNAL_DRIVER_, SC_DO_NOTHING);
         // Start Simulation
         sc_start();
+        log_close();
 
 		sc_close_vcd_trace_file(wf);
         
         // Print statistics after simulation finished
         stats_print();
+		hierarchy.print();
+		if (cache[0]->get_snoop_filter() != NULL)
+		{
+			// All caches count in the same snoop filter metrics
+			cache[0]->get_snoop_filter()->print();
+		}
 		bus.output();
 		cout << " \nTotal execution time is " << sc_time_stamp() << endl;
+		metrics_export();
+		delete runner;
     } // end of try
 
     catch (exception& e)